@@ -0,0 +1,57 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file BoundingBox.h
+/// @author Ben Carey
+/// @version 1.0
+/// @date 19/10/19
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifndef BOUNDINGBOX_H_
+#define BOUNDINGBOX_H_
+
+#include <ngl/Vec3.h>
+#include <ngl/Mat4.h>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class BoundingBox
+/// @brief axis aligned bounding box, filled while the tree string is interpreted and used for culling and spatial
+/// queries in the forest. A default constructed box is empty, and becomes a point once the first vertex is added
+//----------------------------------------------------------------------------------------------------------------------
+
+struct BoundingBox
+{
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief default ctor for BoundingBox struct, makes an empty box
+  //--------------------------------------------------------------------------------------------------------------------
+  BoundingBox();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief grows the box to contain _point
+  //--------------------------------------------------------------------------------------------------------------------
+  void expand(const ngl::Vec3 &_point);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief grows the box to contain _box
+  //--------------------------------------------------------------------------------------------------------------------
+  void expand(const BoundingBox &_box);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief true if nothing has been added to the box
+  //--------------------------------------------------------------------------------------------------------------------
+  bool isEmpty() const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief centre of the box, also used as the centre of the bounding sphere
+  //--------------------------------------------------------------------------------------------------------------------
+  ngl::Vec3 centre() const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief radius of the sphere around centre() that contains the box
+  //--------------------------------------------------------------------------------------------------------------------
+  float radius() const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns the box containing this one after it's moved by _transform, using the same row layout as the
+  /// instance transforms (so a point p ends up at p.x*row0 + p.y*row1 + p.z*row2 + row3)
+  //--------------------------------------------------------------------------------------------------------------------
+  BoundingBox transformed(const ngl::Mat4 &_transform) const;
+
+  ngl::Vec3 m_min;
+  ngl::Vec3 m_max;
+};
+
+
+#endif //BOUNDINGBOX_H_
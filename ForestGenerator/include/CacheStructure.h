@@ -9,13 +9,35 @@
 #define CACHESTRUCTURE_H_
 
 #include <vector>
-#include <memory>
-#include <ngl/AbstractVAO.h>
+#include <utility>
+#include <algorithm>
+#include <iterator>
+#include <thread>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief how CacheStructure::forEachElement and its reductions visit the elements. Parallel splits the elements into
+/// contiguous blocks on separate threads, so the functor must be safe to call from several threads at once.
+/// ParallelUnsequenced also promises the functor doesn't rely on any ordering within a thread, which the current
+/// std::thread implementation can't make use of yet, so it behaves like Parallel
+//----------------------------------------------------------------------------------------------------------------------
+enum class ExecutionPolicy
+{
+  Sequential,
+  Parallel,
+  ParallelUnsequenced
+};
 
 
 //----------------------------------------------------------------------------------------------------------------------
 /// @class CacheStructure
-/// @brief this class makes it easier to store the nesting of a cache structure
+/// @brief this class makes it easier to store the nesting of a cache structure. Elements are indexed by id, age
+/// and inner index, but are stored in one contiguous array sorted by id then age. Only the (id, age) slots that
+/// have elements are stored, as a sorted list of slot keys with an offset table giving where each one starts (like
+/// a compressed sparse row matrix), so most ids never appearing at most ages costs nothing. A dense table from key to
+/// slot finds slots without searching. Pushed elements are kept per slot until mergePushedElements builds them into
+/// the sorted arrays in one pass, so filling a cache doesn't move every later element on each push. Elements can be
+/// read and set as normal in the meantime, but pointers from getElement are only valid until the next
+/// pushBackElement or merge
 //----------------------------------------------------------------------------------------------------------------------
 
 template<class T>
@@ -27,135 +49,496 @@ public:
   CacheStructure() = default;
   ~CacheStructure() = default;
 
-  std::vector<std::vector<std::vector<T>>> m_cache = {};
-
   void resizeCache(size_t _numBranches, size_t _numGenerations);
   template<class U>
-  void resizeCache(CacheStructure<U> &_otherCacheStructure);
-
-  size_t numInstancesAt(size_t _id, size_t _age);
+  void resizeCache(const CacheStructure<U> &_otherCacheStructure);
+
+  size_t numIds() const;
+  size_t numAges() const;
+  size_t numInstancesAt(size_t _id, size_t _age) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief number of (id, age) slots with at least one element. Like findSlot, slotId, slotAge and the arrays
+  /// themselves, this only covers merged elements, see mergePushedElements
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t numSlots() const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief where slot (_id, _age) is in m_slotKeys and m_offsets, or numSlots() if it has no merged elements
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t findSlot(size_t _id, size_t _age) const;
+  size_t slotId(size_t _slot) const;
+  size_t slotAge(size_t _slot) const;
 
   T* getElement(size_t _id, size_t _age, size_t _innerIndex);
-  void setElement(size_t _id, size_t _age, size_t _innerIndex, T& _value);
+  void setElement(size_t _id, size_t _age, size_t _innerIndex, T _value);
   T* getLastElementAt(size_t _id, size_t _age);
-  void pushBackElement(size_t _id, size_t _age, T& _value);
-
+  void pushBackElement(size_t _id, size_t _age, T _value);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief moves every element pushed since the last merge into m_elements, m_slotKeys and m_offsets, in one pass
+  /// over the cache. Everything that visits the elements in order merges first, so this only needs calling before
+  /// using the arrays directly
+  //--------------------------------------------------------------------------------------------------------------------
+  void mergePushedElements();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief rebuilds the table from key to slot, for when m_slotKeys has been set directly, eg. by loading a file
+  //--------------------------------------------------------------------------------------------------------------------
+  void indexSlots();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief removes every element for which _predicate(element, id, age, innerIndex) is true, in one pass, keeping
+  /// the rest in the same order, and drops any slots left empty. The predicate is called for every element in id
+  /// then age order
+  //--------------------------------------------------------------------------------------------------------------------
+  template<class predicate>
+  void eraseIf(predicate &&_predicate);
+
+  size_t numElements() const;
+
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief calls _function(element, id, age, innerIndex) for every element, in id then age order when sequential.
+  /// The functor is passed by reference rather than copied, and the element and indices are passed as references
+  //--------------------------------------------------------------------------------------------------------------------
   template<class functor>
-  void forEachElement(functor _function);
+  void forEachElement(functor &&_function);
+  template<class functor>
+  void forEachElement(ExecutionPolicy _policy, functor &&_function);
+
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief combines _map(element, id, age, innerIndex) for every element using _reduce. Each thread starts from
+  /// _init, so it should be an identity of _reduce (eg. 0 for a sum or an empty BoundingBox), and the partial results
+  /// are combined in element order, so an associative _reduce gives the same result whatever the policy
+  //--------------------------------------------------------------------------------------------------------------------
+  template<class R, class mapFunctor, class reduceFunctor>
+  R transformReduce(ExecutionPolicy _policy, R _init, mapFunctor &&_map, reduceFunctor &&_reduce);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief number of elements for which _predicate(element, id, age, innerIndex) is true
+  //--------------------------------------------------------------------------------------------------------------------
+  template<class predicate>
+  size_t countIf(ExecutionPolicy _policy, predicate &&_predicate);
+
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief every element, sorted by id then age
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<T> m_elements = {};
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief id*m_numAges+age of every slot with elements, in increasing order
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<size_t> m_slotKeys = {};
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the elements of the slot with key m_slotKeys[s] are m_elements[m_offsets[s]] up to (but not including)
+  /// m_elements[m_offsets[s+1]]
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<size_t> m_offsets = {0};
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the range of ids and ages the cache can hold
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t m_numIds = 0;
+  size_t m_numAges = 0;
+
+private:
+  template<class U>
+  friend class CacheStructure;
+
+  static constexpr size_t NO_SLOT = size_t(-1);
+
+  size_t key(size_t _id, size_t _age) const { return _id*m_numAges+_age; }
+  size_t numMergedAt(size_t _key) const;
+  T* elementAt(size_t _id, size_t _age, size_t _innerIndex);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the slot keys and offsets the cache will have once the pushed elements are merged
+  //--------------------------------------------------------------------------------------------------------------------
+  void mergedSlots(std::vector<size_t> &_slotKeys, std::vector<size_t> &_offsets) const;
+
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the slot of every key, or NO_SLOT if it has no merged elements
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<size_t> m_slotOfKey = {};
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief elements pushed since the last merge, by key. Only allocated while there are some
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<std::vector<T>> m_pushed = {};
+  size_t m_numPushed = 0;
+
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief calls _function(element, id, age, innerIndex) for the elements from _begin up to _end
+  //--------------------------------------------------------------------------------------------------------------------
+  template<class functor>
+  void forEachElementInRange(size_t _begin, size_t _end, functor &_function);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief splits the elements into _numBlocks contiguous blocks and calls _function(begin, end, block) for each,
+  /// on separate threads unless _policy is Sequential
+  //--------------------------------------------------------------------------------------------------------------------
+  template<class functor>
+  void forEachBlock(ExecutionPolicy _policy, size_t _numBlocks, functor &_function);
+  size_t numBlocks(ExecutionPolicy _policy) const;
 };
 
 //----------------------------------------------------------------------------------------------------------------------
-///specialization
+///note that because this is a template class, all definitions need to be in the header file
 //----------------------------------------------------------------------------------------------------------------------
 
-template<>
-class CacheStructure<std::unique_ptr<ngl::AbstractVAO>>
+template <class T>
+constexpr size_t CacheStructure<T>::NO_SLOT;
+
+template <class T>
+void CacheStructure<T>::resizeCache(size_t _numBranches, size_t _numGenerations)
 {
+  m_numIds = _numBranches;
+  m_numAges = _numGenerations+1;
+  m_elements.clear();
+  m_slotKeys.clear();
+  m_offsets.assign(1, 0);
+  m_slotOfKey.assign(m_numIds*m_numAges, NO_SLOT);
+  std::vector<std::vector<T>>().swap(m_pushed);
+  m_numPushed = 0;
+}
 
-public:
+template <class T>
+template <class U>
+void CacheStructure<T>::resizeCache(const CacheStructure<U> &_otherCacheStructure)
+{
+  //same shape as the other cache, with default constructed elements
+  m_numIds = _otherCacheStructure.m_numIds;
+  m_numAges = _otherCacheStructure.m_numAges;
+  _otherCacheStructure.mergedSlots(m_slotKeys, m_offsets);
+  m_elements.clear();
+  m_elements.resize(m_offsets.back());
+  indexSlots();
+  std::vector<std::vector<T>>().swap(m_pushed);
+  m_numPushed = 0;
+}
 
-  CacheStructure() = default;
+template <class T>
+size_t CacheStructure<T>::numIds() const
+{
+  return m_numIds;
+}
 
-  //delete copy ctors so we don't copy unique_ptr
-  CacheStructure(const CacheStructure&) = delete;
-  CacheStructure& operator=(const CacheStructure&) = delete;
+template <class T>
+size_t CacheStructure<T>::numAges() const
+{
+  return m_numAges;
+}
 
-  ~CacheStructure() = default;
+template <class T>
+size_t CacheStructure<T>::numInstancesAt(size_t _id, size_t _age) const
+{
+  if(_id >= m_numIds || _age >= m_numAges)
+  {
+    return 0;
+  }
+  size_t k = key(_id,_age);
+  return numMergedAt(k) + (m_numPushed == 0 ? 0 : m_pushed[k].size());
+}
 
-  std::vector<std::vector<std::vector<std::unique_ptr<ngl::AbstractVAO>>>> m_cache = {};
+template <class T>
+size_t CacheStructure<T>::numSlots() const
+{
+  return m_slotKeys.size();
+}
 
-  void resizeCache(size_t _numBranches, size_t _numGenerations);
-  template<class U>
-  void resizeCache(CacheStructure<U> &_otherCacheStructure);
+template <class T>
+size_t CacheStructure<T>::findSlot(size_t _id, size_t _age) const
+{
+  if(_id >= m_numIds || _age >= m_numAges)
+  {
+    return numSlots();
+  }
+  size_t s = m_slotOfKey[key(_id,_age)];
+  return s == NO_SLOT ? numSlots() : s;
+}
 
-  size_t numInstancesAt(size_t _id, size_t _age);
+template <class T>
+size_t CacheStructure<T>::slotId(size_t _slot) const
+{
+  return m_slotKeys[_slot]/m_numAges;
+}
 
-  std::unique_ptr<ngl::AbstractVAO>* getElement(size_t _id, size_t _age, size_t _innerIndex);
-  void setElement(size_t _id, size_t _age, size_t _innerIndex, std::unique_ptr<ngl::AbstractVAO>& _value);
-  std::unique_ptr<ngl::AbstractVAO>* getLastElementAt(size_t _id, size_t _age);
-  void pushBackElement(size_t _id, size_t _age, std::unique_ptr<ngl::AbstractVAO>& _value);
+template <class T>
+size_t CacheStructure<T>::slotAge(size_t _slot) const
+{
+  return m_slotKeys[_slot]%m_numAges;
+}
 
-  template<class functor>
-  void forEachElement(functor _function);
-};
+template <class T>
+size_t CacheStructure<T>::numMergedAt(size_t _key) const
+{
+  size_t s = m_slotOfKey[_key];
+  return s == NO_SLOT ? 0 : m_offsets[s+1]-m_offsets[s];
+}
 
-//----------------------------------------------------------------------------------------------------------------------
-///note that because this is a template class, all definitions need to be in the header file
-//----------------------------------------------------------------------------------------------------------------------
+template <class T>
+T* CacheStructure<T>::elementAt(size_t _id, size_t _age, size_t _innerIndex)
+{
+  //pushed elements come after the merged ones in the same slot
+  if(m_numPushed > 0)
+  {
+    size_t k = key(_id,_age);
+    size_t numMerged = numMergedAt(k);
+    if(_innerIndex >= numMerged)
+    {
+      return &m_pushed[k][_innerIndex-numMerged];
+    }
+  }
+  return &m_elements[m_offsets[findSlot(_id,_age)]+_innerIndex];
+}
 
 template <class T>
-void CacheStructure<T>::resizeCache(size_t _numBranches, size_t _numGenerations)
+T* CacheStructure<T>::getElement(size_t _id, size_t _age, size_t _innerIndex)
 {
-  m_cache = {};
-  m_cache.resize(_numBranches,{});
-  for(auto &vec : m_cache)
+  return elementAt(_id,_age,_innerIndex);
+}
+
+template <class T>
+void CacheStructure<T>::setElement(size_t _id, size_t _age, size_t _innerIndex, T _value)
+{
+  *elementAt(_id,_age,_innerIndex) = std::move(_value);
+}
+
+template <class T>
+T* CacheStructure<T>::getLastElementAt(size_t _id, size_t _age)
+{
+  return elementAt(_id,_age,numInstancesAt(_id,_age)-1);
+}
+
+template <class T>
+void CacheStructure<T>::pushBackElement(size_t _id, size_t _age, T _value)
+{
+  if(m_pushed.empty())
   {
-    vec.resize(_numGenerations+1,{});
+    m_pushed.resize(m_numIds*m_numAges);
   }
+  m_pushed[key(_id,_age)].push_back(std::move(_value));
+  m_numPushed++;
 }
 
 template <class T>
-template <class U>
-void CacheStructure<T>::resizeCache(CacheStructure<U> &_otherCacheStructure)
+void CacheStructure<T>::mergedSlots(std::vector<size_t> &_slotKeys, std::vector<size_t> &_offsets) const
 {
-  m_cache = {};
-  std::vector<std::vector<std::vector<U>>> otherCache = _otherCacheStructure.m_cache;
-  m_cache.resize(otherCache.size(),{});
-  for(size_t id=0; id<m_cache.size(); id++)
+  if(m_numPushed == 0)
+  {
+    _slotKeys = m_slotKeys;
+    _offsets = m_offsets;
+    return;
+  }
+  _slotKeys.clear();
+  _offsets.assign(1, 0);
+  for(size_t k=0; k<m_pushed.size(); k++)
   {
-    m_cache[id].resize(otherCache[id].size(),{});
-    for(size_t age=0; age<m_cache[id].size(); age++)
+    size_t size = numMergedAt(k)+m_pushed[k].size();
+    if(size > 0)
     {
-      m_cache[id][age].resize(otherCache[id][age].size(),{});
+      _slotKeys.push_back(k);
+      _offsets.push_back(_offsets.back()+size);
     }
   }
 }
 
 template <class T>
-size_t CacheStructure<T>::numInstancesAt(size_t _id, size_t _age)
+void CacheStructure<T>::mergePushedElements()
 {
-  return m_cache[_id][_age].size();
+  if(m_numPushed == 0)
+  {
+    return;
+  }
+  std::vector<size_t> slotKeys = {};
+  std::vector<size_t> offsets = {};
+  mergedSlots(slotKeys, offsets);
+  std::vector<T> elements = {};
+  elements.reserve(offsets.back());
+  for(auto k : slotKeys)
+  {
+    size_t s = m_slotOfKey[k];
+    if(s != NO_SLOT)
+    {
+      std::move(m_elements.begin()+long(m_offsets[s]), m_elements.begin()+long(m_offsets[s+1]),
+                std::back_inserter(elements));
+    }
+    std::move(m_pushed[k].begin(), m_pushed[k].end(), std::back_inserter(elements));
+  }
+  m_elements = std::move(elements);
+  m_slotKeys = std::move(slotKeys);
+  m_offsets = std::move(offsets);
+  indexSlots();
+  std::vector<std::vector<T>>().swap(m_pushed);
+  m_numPushed = 0;
 }
 
 template <class T>
-T* CacheStructure<T>::getElement(size_t _id, size_t _age, size_t _innerIndex)
+void CacheStructure<T>::indexSlots()
 {
-  return &m_cache[_id][_age][_innerIndex];
+  m_slotOfKey.assign(m_numIds*m_numAges, NO_SLOT);
+  for(size_t s=0; s<m_slotKeys.size(); s++)
+  {
+    m_slotOfKey[m_slotKeys[s]] = s;
+  }
 }
 
 template <class T>
-void CacheStructure<T>::setElement(size_t _id, size_t _age, size_t _innerIndex, T& _value)
+template <class predicate>
+void CacheStructure<T>::eraseIf(predicate &&_predicate)
 {
-  m_cache[_id][_age][_innerIndex] = _value;
+  mergePushedElements();
+  size_t numKept = 0;
+  size_t numSlotsKept = 0;
+  size_t index = 0;
+  for(size_t s=0; s<m_slotKeys.size(); s++)
+  {
+    size_t end = m_offsets[s+1];
+    size_t slotStart = numKept;
+    size_t id = slotId(s);
+    size_t age = slotAge(s);
+    for(size_t innerIndex=0; index<end; innerIndex++, index++)
+    {
+      if(_predicate(m_elements[index], id, age, innerIndex) == false)
+      {
+        if(numKept != index)
+        {
+          m_elements[numKept] = std::move(m_elements[index]);
+        }
+        numKept++;
+      }
+    }
+    if(numKept > slotStart)
+    {
+      m_slotKeys[numSlotsKept] = m_slotKeys[s];
+      m_offsets[numSlotsKept] = slotStart;
+      numSlotsKept++;
+    }
+  }
+  m_slotKeys.resize(numSlotsKept);
+  m_offsets.resize(numSlotsKept+1);
+  m_offsets.back() = numKept;
+  m_elements.erase(m_elements.begin()+long(numKept), m_elements.end());
+  indexSlots();
 }
 
 template <class T>
-T* CacheStructure<T>::getLastElementAt(size_t _id, size_t _age)
+size_t CacheStructure<T>::numElements() const
 {
-  return &m_cache[_id][_age].back();
+  return m_elements.size()+m_numPushed;
 }
 
-template <class T>
-void CacheStructure<T>::pushBackElement(size_t _id, size_t _age, T& _value)
+template<class T>
+template<class functor>
+void CacheStructure<T>::forEachElement(functor &&_function)
 {
-  m_cache[_id][_age].push_back(_value);
+  mergePushedElements();
+  forEachElementInRange(0, m_elements.size(), _function);
 }
 
 template<class T>
 template<class functor>
-void CacheStructure<T>::forEachElement(functor _function)
+void CacheStructure<T>::forEachElement(ExecutionPolicy _policy, functor &&_function)
 {
-  for(size_t id=0; id<m_cache.size(); id++)
+  mergePushedElements();
+  auto visitBlock = [&](size_t _begin, size_t _end, size_t)
   {
-    for(size_t age=0; age<m_cache[id].size(); age++)
+    forEachElementInRange(_begin, _end, _function);
+  };
+  forEachBlock(_policy, numBlocks(_policy), visitBlock);
+}
+
+template<class T>
+template<class R, class mapFunctor, class reduceFunctor>
+R CacheStructure<T>::transformReduce(ExecutionPolicy _policy, R _init, mapFunctor &&_map, reduceFunctor &&_reduce)
+{
+  mergePushedElements();
+  size_t blocks = numBlocks(_policy);
+  std::vector<R> partialResults(blocks, _init);
+  auto reduceBlock = [&](size_t _begin, size_t _end, size_t _block)
+  {
+    R &result = partialResults[_block];
+    auto reduceElement = [&](T &_element, size_t &_id, size_t &_age, size_t &_innerIndex)
     {
-      for(size_t innerIndex=0; innerIndex<m_cache[id][age].size(); innerIndex++)
-      {
-        _function(m_cache[id][age][innerIndex], id, age, innerIndex);
-      }
+      result = _reduce(result, _map(_element, _id, _age, _innerIndex));
+    };
+    forEachElementInRange(_begin, _end, reduceElement);
+  };
+  forEachBlock(_policy, blocks, reduceBlock);
+
+  R result = _init;
+  for(auto &partialResult : partialResults)
+  {
+    result = _reduce(result, partialResult);
+  }
+  return result;
+}
+
+template<class T>
+template<class predicate>
+size_t CacheStructure<T>::countIf(ExecutionPolicy _policy, predicate &&_predicate)
+{
+  return transformReduce(_policy, size_t(0),
+                         [&](T &_element, size_t &_id, size_t &_age, size_t &_innerIndex)
+                         {
+                           return _predicate(_element, _id, _age, _innerIndex) ? size_t(1) : size_t(0);
+                         },
+                         [](size_t _a, size_t _b) { return _a+_b; });
+}
+
+template<class T>
+template<class functor>
+void CacheStructure<T>::forEachElementInRange(size_t _begin, size_t _end, functor &_function)
+{
+  if(_begin >= _end)
+  {
+    return;
+  }
+  //the slot holding _begin is the last one starting at or before it
+  size_t s = size_t(std::upper_bound(m_offsets.begin(), m_offsets.end(), _begin)-m_offsets.begin())-1;
+  for(size_t index=_begin; index<_end; index++)
+  {
+    while(m_offsets[s+1] <= index)
+    {
+      s++;
     }
+    size_t id = slotId(s);
+    size_t age = slotAge(s);
+    size_t innerIndex = index-m_offsets[s];
+    _function(m_elements[index], id, age, innerIndex);
   }
 }
 
+template<class T>
+size_t CacheStructure<T>::numBlocks(ExecutionPolicy _policy) const
+{
+  if(_policy == ExecutionPolicy::Sequential)
+  {
+    return 1;
+  }
+  size_t numThreads = std::max(size_t(1), size_t(std::thread::hardware_concurrency()));
+  return std::max(size_t(1), std::min(numThreads, m_elements.size()));
+}
+
+template<class T>
+template<class functor>
+void CacheStructure<T>::forEachBlock(ExecutionPolicy _policy, size_t _numBlocks, functor &_function)
+{
+  size_t size = m_elements.size();
+  auto runBlock = [&](size_t _block)
+  {
+    _function(size*_block/_numBlocks, size*(_block+1)/_numBlocks, _block);
+  };
+
+  if(_policy == ExecutionPolicy::Sequential || _numBlocks < 2)
+  {
+    for(size_t b=0; b<_numBlocks; b++)
+    {
+      runBlock(b);
+    }
+    return;
+  }
+
+  //the calling thread takes the first block
+  std::vector<std::thread> threads = {};
+  for(size_t b=1; b<_numBlocks; b++)
+  {
+    threads.push_back(std::thread(runBlock, b));
+  }
+  runBlock(0);
+  for(auto &thread : threads)
+  {
+    thread.join();
+  }
+}
 
 #endif //CACHESTRUCTURE_H_
@@ -53,6 +53,30 @@ public:
     /// @brief transform matrix for tree, representing position and orientation
     //--------------------------------------------------------------------------------------------------------------------
     ngl::Mat4 m_transform;
+    //--------------------------------------------------------------------------------------------------------------------
+    /// @brief world space bounds of all the instances making up the tree, filled by createForest
+    //--------------------------------------------------------------------------------------------------------------------
+    BoundingBox m_bounds;
+    //--------------------------------------------------------------------------------------------------------------------
+    /// @brief true if the tree has its own geometry in m_uniqueTrees rather than being built from instances
+    //--------------------------------------------------------------------------------------------------------------------
+    bool m_isUnique = false;
+  };
+
+  //UNIQUE TREE STRUCT
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief full detail geometry generated for a single tree in hybrid mode, in the tree's own space (so it's drawn
+  /// with the tree's m_transform)
+  //--------------------------------------------------------------------------------------------------------------------
+  struct UniqueTree
+  {
+    size_t m_treeIndex;
+    std::vector<ngl::Vec3> m_vertices;
+    std::vector<GLuint> m_indices;
+    //--------------------------------------------------------------------------------------------------------------------
+    /// @brief true if m_vertices and m_indices are a tube mesh (drawn as triangles) rather than lines
+    //--------------------------------------------------------------------------------------------------------------------
+    bool m_isTubeMesh = false;
   };
 
   //OUTPUT DATA STRUCT
@@ -68,6 +92,86 @@ public:
 
     ngl::Mat4 m_transform;
     size_t m_treeType, m_id, m_age, m_innerIndex;
+    //world space bounds of the instance
+    BoundingBox m_bounds;
+  };
+
+  //EXPANSION PLAN STRUCTS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief everything createTree outputs for the instances in the top m_expansionPlanDepth levels of one possible
+  /// subtree, with the instances below the first level already picked, so the subtree can be output with one matrix
+  /// multiply per transform rather than a recursive walk. The plan is ranges in its tree type's ExpansionPlanArena
+  //--------------------------------------------------------------------------------------------------------------------
+  struct ExpansionPlan
+  {
+    bool m_isBuilt = false;
+    size_t m_firstInstance = 0;
+    size_t m_numInstances = 0;
+    size_t m_firstLeaf = 0;
+    size_t m_numLeaves = 0;
+    size_t m_firstExitPoint = 0;
+    size_t m_numExitPoints = 0;
+  };
+
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the contents of every expansion plan of one tree type, one after another. Transforms are relative to the
+  /// transform createTree is given
+  //--------------------------------------------------------------------------------------------------------------------
+  struct ExpansionPlanArena
+  {
+    //--------------------------------------------------------------------------------------------------------------------
+    /// @brief the instances in the plans, with their bounds in the same space as the hero vertices
+    //--------------------------------------------------------------------------------------------------------------------
+    std::vector<OutputData> m_instances;
+    std::vector<ngl::Mat4> m_leaves;
+    //--------------------------------------------------------------------------------------------------------------------
+    /// @brief exit points below the last level of the plans, which createTree carries on from
+    //--------------------------------------------------------------------------------------------------------------------
+    std::vector<Instance::ExitPoint> m_exitPoints;
+  };
+
+  //TUNING STRUCTS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief what tuneInstancing aims for in a small sample forest of one tree type, and which values it tries
+  //--------------------------------------------------------------------------------------------------------------------
+  struct TuningTargets
+  {
+    //--------------------------------------------------------------------------------------------------------------------
+    /// @brief most bytes of vertex, index and instance transform data the sample forest can need, 0 for no limit
+    //--------------------------------------------------------------------------------------------------------------------
+    size_t m_maxBytes = 0;
+    //--------------------------------------------------------------------------------------------------------------------
+    /// @brief most instanced draw calls (instances that are used at least once) the sample forest can need, 0 for no
+    /// limit
+    //--------------------------------------------------------------------------------------------------------------------
+    size_t m_maxDrawCalls = 0;
+    //--------------------------------------------------------------------------------------------------------------------
+    /// @brief number of instances each tree should be built from, 0 for no target
+    //--------------------------------------------------------------------------------------------------------------------
+    float m_instancesPerTree = 0.0f;
+
+    std::vector<float> m_instancingProbs = {0.2f, 0.35f, 0.5f, 0.65f, 0.8f, 0.95f};
+    std::vector<size_t> m_maxInstancesPerLevel = {1, 2, 4, 8, 16, 32};
+    float m_width = 50.0f;
+    float m_length = 50.0f;
+    size_t m_numTrees = 20;
+    int m_numHeroTrees = 5;
+  };
+
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the values tried for one sample and what the sample forest needed with them
+  //--------------------------------------------------------------------------------------------------------------------
+  struct TuningSample
+  {
+    float m_instancingProb;
+    size_t m_maxInstancePerLevel;
+    size_t m_bytes;
+    size_t m_drawCalls;
+    float m_instancesPerTree;
+    //--------------------------------------------------------------------------------------------------------------------
+    /// @brief how far over the byte and draw call limits the sample is, as a sum of fractions, 0 if it fits
+    //--------------------------------------------------------------------------------------------------------------------
+    float m_overBudget;
   };
 
   //PUBLIC MEMBER VARIABLES
@@ -110,10 +214,51 @@ public:
   //outer std::vector separates tree_types
   //inner std::vector separates different branches using the same instance
   std::vector<CacheStructure<std::vector<ngl::Mat4>>> m_outputCache;
+  //world transforms of every leaf card, separated by tree type so each type's leaves are one instanced draw
+  std::vector<std::vector<ngl::Mat4>> m_leafOutput;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief levels of instances each expansion plan covers. 1 doesn't use plans at all, and walks the tree picking
+  /// every instance as it's reached, so the forest is as varied as the instance cache allows. Deeper plans grow every
+  /// use of an instance from one of m_numExpansionPlanVariants subtrees, so they're left for callers to opt in to
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t m_expansionPlanDepth = 1;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief number of plans kept for each instance when they're deeper than 1 level. Each is built with its own picks,
+  /// using getInstance's weights, and each use of the instance picks one of them uniformly, so the subtrees grown
+  /// beneath an instance come out as often as a recursive walk would make them, just from a smaller set
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t m_numExpansionPlanVariants = 8;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the expansion plans for each instance, arranged like m_outputCache. Each plan is built the first time it's
+  /// picked after resizeOutputCache
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<CacheStructure<std::vector<ExpansionPlan>>> m_expansionPlans;
+  std::vector<ExpansionPlanArena> m_expansionPlanArenas;
 
   //the random number generator
   std::default_random_engine m_gen;
 
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief toggle for hybrid mode, where the m_numUniqueTrees trees nearest m_focusPoint get their own full detail
+  /// geometry and the rest are built from instances as usual
+  //--------------------------------------------------------------------------------------------------------------------
+  bool m_hybridMode = false;
+  size_t m_numUniqueTrees = 4;
+  ngl::Vec3 m_focusPoint = ngl::Vec3(0,0,0);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief time in seconds allowed for generating unique trees, any trees not started by then are instanced instead
+  //--------------------------------------------------------------------------------------------------------------------
+  float m_uniqueTreeBudget = 1.0f;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief copies of the tree types taken before their instance caches were filled (which adds instancing commands
+  /// to their rules), used to generate unique trees
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<LSystem> m_uniqueTreeTypes;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the unique trees made by createUniqueTrees, nearest first
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<UniqueTree> m_uniqueTrees;
+
 
   //PUBLIC METHODS
   //--------------------------------------------------------------------------------------------------------------------
@@ -122,17 +267,65 @@ public:
   void scatterForest();
   //--------------------------------------------------------------------------------------------------------------------
   /// @brief create geometry of tree by taking instances from the instance cache
+  /// @param [out] _treeBounds grown to contain the world space bounds of every instance used
   //--------------------------------------------------------------------------------------------------------------------
-  void createTree(size_t _treeType, ngl::Mat4 _transform, size_t _id, size_t _age);
+  void createTree(size_t _treeType, ngl::Mat4 _transform, size_t _id, size_t _age, BoundingBox &_treeBounds);
 
   Instance * getInstance(LSystem &_treeType, size_t _id, size_t _age, size_t &_innerIndex);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief adds an instance drawn with _transform to m_output and m_outputCache, and its world space bounds to
+  /// _treeBounds
+  //--------------------------------------------------------------------------------------------------------------------
+  void outputInstance(size_t _treeType, const ngl::Mat4 &_transform, size_t _id, size_t _age, size_t _innerIndex,
+                      const BoundingBox &_bounds, BoundingBox &_treeBounds);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief fills one of the expansion plans of an instance in m_expansionPlans, down to m_expansionPlanDepth levels
+  //--------------------------------------------------------------------------------------------------------------------
+  void buildExpansionPlan(size_t _treeType, size_t _id, size_t _age, size_t _innerIndex, size_t _variant);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief adds an instance at _transform, relative to the plan's root, and the levels below it to the end of the
+  /// tree type's ExpansionPlanArena
+  //--------------------------------------------------------------------------------------------------------------------
+  void addToExpansionPlan(size_t _treeType, ngl::Mat4 _transform, size_t _id, size_t _age, size_t _innerIndex,
+                          size_t _level);
 
   void createForest();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief generates unique geometry for the m_numUniqueTrees trees nearest m_focusPoint on several threads, nearest
+  /// first, until m_uniqueTreeBudget runs out. Fills m_uniqueTrees and marks those trees with m_isUnique
+  //--------------------------------------------------------------------------------------------------------------------
+  void createUniqueTrees();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief prunes each tree type's instance cache to fit the budgets using how often this forest drew each instance,
+  /// see LSystem::optimiseInstanceVariety, then makes the forest again. The budgets are shared between the tree types
+  /// by how many instances of each the forest draws, with at least 1 each
+  /// @param [in] _indexBudget most hero indices to keep over all the tree types, 0 for no limit
+  /// @param [in] _variantBudget most instances to keep over all the tree types (and so most draw calls), 0 for no limit
+  //--------------------------------------------------------------------------------------------------------------------
+  void optimiseInstanceVariety(size_t _indexBudget, size_t _variantBudget);
 
   void resizeOutputCache();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief gives m_outputCache[_treeType] and m_expansionPlans[_treeType] the shape of the tree type's instance cache
+  /// again after instances have been added to it, keeping the transforms already output and the plans already built
+  //--------------------------------------------------------------------------------------------------------------------
+  void syncOutputCache(size_t _treeType);
 
   void seedRandomEngine();
 
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief searches every combination of the instancing probabilities and variant limits in _targets, filling the
+  /// instance cache and making a small seeded forest of _species for each on several threads, and records the best
+  /// in _species.m_instancingProb and _species.m_maxInstancePerLevel. The best is the one that fits the byte and draw
+  /// call limits (or goes over them least), then gets closest to the instances per tree target, then uses the most
+  /// variants
+  /// @param [in,out] _species tree type to tune, before its instance cache has been filled
+  /// @param [out] _samples if not null, filled with every sample in the order tried
+  /// @return the chosen sample
+  //--------------------------------------------------------------------------------------------------------------------
+  static TuningSample tuneInstancing(LSystem &_species, const TuningTargets &_targets,
+                                     std::vector<TuningSample> *_samples = nullptr);
+
 };
 
 #endif //FOREST_H_
@@ -0,0 +1,134 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file GeometrySink.h
+/// @author Ben Carey
+/// @version 1.0
+/// @date 19/10/19
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifndef GEOMETRYSINK_H_
+#define GEOMETRYSINK_H_
+
+#include <iostream>
+#include <vector>
+#include <ngl/Vec3.h>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class GeometrySink
+/// @brief abstract consumer for the geometry created by LSystem::createGeometry. The turtle hands each vertex and
+/// line segment straight to the sink, so consumers that don't need the full vertex list never have to build one
+//----------------------------------------------------------------------------------------------------------------------
+
+class GeometrySink
+{
+public:
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief virtual dtor so sinks can be deleted through a base pointer
+  //--------------------------------------------------------------------------------------------------------------------
+  virtual ~GeometrySink() = default;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief adds a vertex
+  /// @param [in] _vertex the vertex position
+  /// @param [in] _width the branch width at the vertex
+  /// @return the index of the new vertex, to be used in addSegment
+  //--------------------------------------------------------------------------------------------------------------------
+  virtual GLuint addVertex(const ngl::Vec3 &_vertex, float _width) = 0;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief adds a line segment between two vertices that have already been added
+  //--------------------------------------------------------------------------------------------------------------------
+  virtual void addSegment(GLuint _start, GLuint _end) = 0;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief number of indices (two per segment) added so far, used to mark the start and end of instances
+  //--------------------------------------------------------------------------------------------------------------------
+  virtual size_t numIndices() const = 0;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief hint that roughly this many more vertices and indices are about to be added
+  //--------------------------------------------------------------------------------------------------------------------
+  virtual void reserve(size_t /*_numVertices*/, size_t /*_numIndices*/) {}
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class BufferSink
+/// @brief appends geometry to vertex, index and width vectors - this is what fills LSystem::m_vertices etc.
+//----------------------------------------------------------------------------------------------------------------------
+
+class BufferSink : public GeometrySink
+{
+public:
+  BufferSink(std::vector<ngl::Vec3> &_vertices, std::vector<GLuint> &_indices, std::vector<float> &_widths);
+
+  GLuint addVertex(const ngl::Vec3 &_vertex, float _width) override;
+  void addSegment(GLuint _start, GLuint _end) override;
+  size_t numIndices() const override;
+  void reserve(size_t _numVertices, size_t _numIndices) override;
+
+  std::vector<ngl::Vec3> &m_vertices;
+  std::vector<GLuint> &m_indices;
+  std::vector<float> &m_widths;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class ArraySink
+/// @brief writes geometry into fixed size arrays, eg. GL buffers mapped with glMapBuffer. Anything past the end of
+/// either array is counted but not written, and m_overflow is set
+//----------------------------------------------------------------------------------------------------------------------
+
+class ArraySink : public GeometrySink
+{
+public:
+  ArraySink(ngl::Vec3 * _vertices, size_t _maxVertices, GLuint * _indices, size_t _maxIndices);
+
+  GLuint addVertex(const ngl::Vec3 &_vertex, float _width) override;
+  void addSegment(GLuint _start, GLuint _end) override;
+  size_t numIndices() const override;
+
+  ngl::Vec3 * m_vertices;
+  size_t m_maxVertices;
+  GLuint * m_indices;
+  size_t m_maxIndices;
+  size_t m_numVertices = 0;
+  size_t m_numIndices = 0;
+  bool m_overflow = false;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class BoundsSink
+/// @brief keeps only the bounding box and vertex/segment counts of the geometry, without storing any of it
+//----------------------------------------------------------------------------------------------------------------------
+
+class BoundsSink : public GeometrySink
+{
+public:
+  BoundsSink() = default;
+
+  GLuint addVertex(const ngl::Vec3 &_vertex, float _width) override;
+  void addSegment(GLuint _start, GLuint _end) override;
+  size_t numIndices() const override;
+
+  ngl::Vec3 m_min = ngl::Vec3(0,0,0);
+  ngl::Vec3 m_max = ngl::Vec3(0,0,0);
+  float m_maxWidth = 0;
+  size_t m_numVertices = 0;
+  size_t m_numSegments = 0;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class OBJSink
+/// @brief writes geometry straight to a stream as Wavefront OBJ vertices and line elements
+//----------------------------------------------------------------------------------------------------------------------
+
+class OBJSink : public GeometrySink
+{
+public:
+  OBJSink(std::ostream &_stream);
+
+  GLuint addVertex(const ngl::Vec3 &_vertex, float _width) override;
+  void addSegment(GLuint _start, GLuint _end) override;
+  size_t numIndices() const override;
+
+  std::ostream &m_stream;
+  size_t m_numVertices = 0;
+  size_t m_numIndices = 0;
+};
+
+
+#endif //GEOMETRYSINK_H_
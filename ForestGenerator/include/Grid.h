@@ -34,7 +34,7 @@ struct Grid
   //--------------------------------------------------------------------------------------------------------------------
   /// @brief index list to tell ngl how to draw the order to draw the L-system vertices in
   //--------------------------------------------------------------------------------------------------------------------
-  std::vector<GLshort> m_indices;
+  std::vector<GLuint> m_indices;
 };
 
 
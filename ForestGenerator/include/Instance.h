@@ -8,12 +8,35 @@
 #ifndef INSTANCE_H_
 #define INSTANCE_H_
 
+#include <vector>
+#include <ngl/Vec3.h>
 #include <ngl/Mat4.h>
+#include "BoundingBox.h"
 
 
+//----------------------------------------------------------------------------------------------------------------------
+/// @class ArenaRange
+/// @brief a view of m_size elements starting at m_begin in one of the arrays of an InstanceArena, so they can be used
+/// in a range based for loop. Only valid until something is next added to the arena
+//----------------------------------------------------------------------------------------------------------------------
+
+template<class T>
+struct ArenaRange
+{
+  T* begin() const { return m_begin; }
+  T* end() const { return m_begin+m_size; }
+  size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+  T& operator[](size_t _index) const { return m_begin[_index]; }
+
+  T* m_begin;
+  size_t m_size;
+};
+
 //----------------------------------------------------------------------------------------------------------------------
 /// @class Instance
-/// @brief this struct stores the data that constitutes an instance, to fill the instance cache in the LSystem
+/// @brief this struct stores the data that constitutes an instance, to fill the instance cache in the LSystem. Its
+/// exit points and leaves are kept in the InstanceArena of the L-system it belongs to
 //----------------------------------------------------------------------------------------------------------------------
 
 struct Instance
@@ -28,10 +51,19 @@ struct Instance
   Instance(ngl::Mat4 _transform);
 
   ngl::Mat4 m_transform;
+  //inverse of m_transform, worked out once by the ctor since every exit point, leaf and forest node needs it
+  ngl::Mat4 m_inverseTransform;
   //GLshort * m_instanceStart;
   //GLshort * m_instanceEnd;
   size_t m_instanceStart;
   size_t m_instanceEnd;
+  //bounds of the instance's geometry (and leaves), in the same space as the hero vertices and m_transform
+  BoundingBox m_bounds;
+  //matching range in the line strip indices, only filled in strip mode
+  size_t m_stripStart = 0;
+  size_t m_stripEnd = 0;
+  //number of generated instances this entry stands for, after identical ones at the same id and age are merged
+  size_t m_weight = 1;
   //std::vector<GLshort> m_indices;
 
   struct ExitPoint
@@ -42,7 +74,53 @@ struct Instance
     ngl::Mat4 m_exitTransform;
   };
 
-  std::vector<ExitPoint> m_exitPoints;
+  //this instance's exit points are m_exitPoints[m_firstExitPoint] onwards in its InstanceArena
+  size_t m_firstExitPoint = 0;
+  size_t m_numExitPoints = 0;
+
+  //a leaf card placed by the ~ command, stored as just a position, frame and size rather than a whole matrix
+  struct Leaf
+  {
+    Leaf(const ngl::Mat4 &_transform, float _size);
+    ngl::Mat4 transform() const;
+    ngl::Vec3 m_position;
+    ngl::Vec3 m_dir;
+    ngl::Vec3 m_right;
+    float m_size;
+  };
+
+  //and its leaves are m_leaves[m_firstLeaf] onwards
+  size_t m_firstLeaf = 0;
+  size_t m_numLeaves = 0;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class InstanceArena
+/// @brief the exit points and leaves of every instance in one instance cache, stored contiguously per instance in
+/// two shared arrays rather than in two vectors owned by each instance, so filling or clearing a cache only takes a
+/// handful of allocations
+//----------------------------------------------------------------------------------------------------------------------
+
+struct InstanceArena
+{
+  ArenaRange<Instance::ExitPoint> exitPoints(const Instance &_instance);
+  ArenaRange<const Instance::ExitPoint> exitPoints(const Instance &_instance) const;
+  ArenaRange<Instance::Leaf> leaves(const Instance &_instance);
+  ArenaRange<const Instance::Leaf> leaves(const Instance &_instance) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief copies _exitPoints and _leaves to the end of the arena and points _instance at them
+  //--------------------------------------------------------------------------------------------------------------------
+  void append(Instance &_instance, const std::vector<Instance::ExitPoint> &_exitPoints,
+              const std::vector<Instance::Leaf> &_leaves);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief copies _instance's exit points and leaves from _other to the end of this arena and points _instance at
+  /// them, eg. when moving an instance from one cache to another
+  //--------------------------------------------------------------------------------------------------------------------
+  void append(Instance &_instance, const InstanceArena &_other);
+  void clear();
+
+  std::vector<Instance::ExitPoint> m_exitPoints = {};
+  std::vector<Instance::Leaf> m_leaves = {};
 };
 
 
@@ -8,14 +8,26 @@
 #ifndef LSYSTEM_H_
 #define LSYSTEM_H_
 
+#include <algorithm>
+#include <cstdint>
 #include <vector>
 #include <random>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
 #include <ngl/Vec3.h>
 #include <ngl/Mat4.h>
 #include "Instance.h"
+#include "Turtle.h"
+#include "GeometrySink.h"
 #include "CacheStructure.h"
 #include "PrintFunctions.h"
 
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief index used to separate line strips in m_stripIndices, drawn with GL_PRIMITIVE_RESTART enabled
+//----------------------------------------------------------------------------------------------------------------------
+constexpr GLuint RESTART_INDEX = 0xFFFFFFFF;
+
 //----------------------------------------------------------------------------------------------------------------------
 /// @class LSystem
 /// @brief this class stores details of the L-system
@@ -84,9 +96,13 @@ public://-----------------------------------------------------------------------
   //--------------------------------------------------------------------------------------------------------------------
   std::vector<Rule> m_rules;
   //--------------------------------------------------------------------------------------------------------------------
-  /// @brief statically sized rule array, used by NGLScene class to fill rules from user inputs
+  /// @brief raw rule strings, filled by NGLScene class from user inputs or by loadRules() from a rule file
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<std::string> m_ruleArray;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief maps each LHS to the index of its rule in m_rules, so breakDownRules doesn't search m_rules linearly
   //--------------------------------------------------------------------------------------------------------------------
-  std::array<std::string,10> m_ruleArray;
+  std::unordered_map<std::string,size_t> m_ruleIndices;
   //--------------------------------------------------------------------------------------------------------------------
   /// @brief string representing all non-terminal elements in the rule system
   //--------------------------------------------------------------------------------------------------------------------
@@ -113,6 +129,18 @@ public://-----------------------------------------------------------------------
   //--------------------------------------------------------------------------------------------------------------------
   float m_angleScale;
   //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the initial branch width, used as the tube radius
+  //--------------------------------------------------------------------------------------------------------------------
+  float m_width = 0.2f;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the default width scale for the '!' command
+  //--------------------------------------------------------------------------------------------------------------------
+  float m_widthScale = 0.7f;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the default leaf size for the '~' command
+  //--------------------------------------------------------------------------------------------------------------------
+  float m_leafSize = 0.5f;
+  //--------------------------------------------------------------------------------------------------------------------
   /// @brief the number of generations of the LSystem to implement
   //--------------------------------------------------------------------------------------------------------------------
   int m_generation;
@@ -144,14 +172,114 @@ public://-----------------------------------------------------------------------
   std::vector<ngl::Vec3> m_vertices;
   //--------------------------------------------------------------------------------------------------------------------
   /// @brief index list to tell ngl how to draw the order to draw the L-system vertices in
+  /// stored as 32-bit so trees with more than 32767 vertices (and the concatenated hero trees) don't wrap around
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<GLuint> m_indices;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief branch width at each vertex in m_vertices
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<float> m_widths;
+
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief leaves placed by the '~' command, drawn as instanced cards rather than added to m_vertices. In forest
+  /// mode they are stored with each instance in m_instanceArena instead
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<Instance::Leaf> m_leaves;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief bounds of the tree made by the last call to createGeometry (or of all the hero trees in forest mode)
   //--------------------------------------------------------------------------------------------------------------------
-  std::vector<GLshort> m_indices;
+  BoundingBox m_bounds;
+
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief toggle to also output the geometry as a triangle tube mesh, as well as the line segments
+  //--------------------------------------------------------------------------------------------------------------------
+  bool m_tubeMode = false;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief number of vertices in each ring of the tube mesh
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t m_tubeSides = 8;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief tube mesh version of m_vertices and m_indices, drawn with GL_TRIANGLES
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<ngl::Vec3> m_tubeVertices;
+  std::vector<GLuint> m_tubeIndices;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief toggle to also output the line geometry as line strips separated by RESTART_INDEX, which roughly halves
+  /// the number of indices for unbranched chains
+  //--------------------------------------------------------------------------------------------------------------------
+  bool m_stripMode = false;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief m_indices as line strips, drawn with GL_LINE_STRIP
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<GLuint> m_stripIndices;
+
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief toggle to merge runs of consecutive segments that point the same way (eg. from FFF) into single segments
+  /// once the geometry has been created, see simplifyGeometry()
+  //--------------------------------------------------------------------------------------------------------------------
+  bool m_simplify = false;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief how far (in degrees) a segment can turn from the start of a run and still be merged into it, 0 only
+  /// merges collinear segments
+  //--------------------------------------------------------------------------------------------------------------------
+  float m_simplifyAngle = 0.0f;
+
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief number of threads createGeometry can use to interpret the top-level branches of a tree in parallel
+  /// outside of forest mode, and fillInstanceCache can use to make hero trees (1 means always work serially)
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t m_numThreads = std::max(size_t(1), size_t(std::thread::hardware_concurrency()));
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief tree strings shorter than this are always interpreted serially, since threads would cost more than they save
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t m_minParallelStringSize = 100000;
 
   std::vector<ngl::Vec3> m_heroVertices = {};
-  std::vector<GLshort> m_heroIndices= {};
+  std::vector<GLuint> m_heroIndices= {};
+  std::vector<float> m_heroWidths = {};
+  std::vector<ngl::Vec3> m_heroTubeVertices = {};
+  std::vector<GLuint> m_heroTubeIndices = {};
+  std::vector<GLuint> m_heroStripIndices = {};
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief toggle to store the hero vertices as 16-bit positions within the bounding box of the hero trees once
+  /// fillInstanceCache is done (not used in tube mode), see quantiseHeroVertices()
+  //--------------------------------------------------------------------------------------------------------------------
+  bool m_quantiseHeroVertices = false;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief quantised hero vertices, 3 per vertex, which replace m_heroVertices when m_quantiseHeroVertices is set.
+  /// A quantised value q dequantises to m_heroQuantiseCentre + m_heroQuantiseScale*q
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<GLshort> m_heroQuantisedVertices = {};
+  ngl::Vec3 m_heroQuantiseCentre = ngl::Vec3(0,0,0);
+  ngl::Vec3 m_heroQuantiseScale = ngl::Vec3(1,1,1);
   bool m_forestMode = false;
 
   size_t m_maxInstancePerLevel = 10;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief toggle to synthesise an instance for every id and age that an exit point leads to but that none of the
+  /// hero trees happened to fill, see fillMissingInstances()
+  //--------------------------------------------------------------------------------------------------------------------
+  bool m_fillMissingInstances = true;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief toggle to merge instances at the same id and age that have the same geometry, exit points and leaves,
+  /// see deduplicateInstances()
+  //--------------------------------------------------------------------------------------------------------------------
+  bool m_deduplicateInstances = true;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief how far apart (in the instance's own space) two vertices can be and still count as the same when
+  /// deduplicating instances
+  //--------------------------------------------------------------------------------------------------------------------
+  float m_deduplicateTolerance = 1e-4f;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief most hero indices the kept instances may draw between them, counting each instance's whole range, see
+  /// optimiseInstanceVariety(). 0 means no limit
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t m_instanceIndexBudget = 0;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief most instances to keep in the cache, which is also the most instanced draw calls a forest of this tree
+  /// can make, see optimiseInstanceVariety(). 0 means no limit
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t m_instanceVariantBudget = 0;
 
   //instance cache is vectors of instances nested 3 deep
   //outer layer separates instances by id
@@ -159,9 +287,170 @@ public://-----------------------------------------------------------------------
   //inner layer separates multiple possible instances of the same id and age
   //so accessing an istance is done by instanceCache[id][age][randomizer]
   CacheStructure<Instance> m_instanceCache;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the exit points and leaves of the instances in m_instanceCache
+  //--------------------------------------------------------------------------------------------------------------------
+  InstanceArena m_instanceArena;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief when hero trees are made separately, the slots (id*numAges+age) filled by the trees made before this one,
+  /// which '<' treats as filled just like its own instance cache, so the branch is only drawn by the first tree to
+  /// reach it. Empty when there are no earlier trees
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<bool> m_earlierHeroSlots = {};
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the slots '<' looked up in m_earlierHeroSlots, which are all the tree depended on from the earlier trees
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<size_t> m_earlierHeroQueries = {};
+
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct SynthesisMutex
+  /// @brief a mutex that isn't shared by copies of the L-system, so it doesn't stop LSystem being copied
+  //--------------------------------------------------------------------------------------------------------------------
+  struct SynthesisMutex
+  {
+    SynthesisMutex() = default;
+    SynthesisMutex(const SynthesisMutex &) {}
+    SynthesisMutex &operator=(const SynthesisMutex &) { return *this; }
+    std::mutex m_mutex;
+  };
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief serialises addMissingInstance calls on this L-system, without holding up any other species
+  //--------------------------------------------------------------------------------------------------------------------
+  SynthesisMutex m_synthesisMutex;
+
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief directory to keep filled instance caches in, see fillInstanceCache(). Empty means always regenerate
+  //--------------------------------------------------------------------------------------------------------------------
+  std::string m_instanceCacheDirectory = "";
+
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct HeroTree
+  /// @brief the geometry and instances of one hero tree, made separately and then added to the hero geometry and
+  /// m_instanceCache by appendHeroTree
+  //--------------------------------------------------------------------------------------------------------------------
+  struct HeroTree
+  {
+    std::vector<ngl::Vec3> m_vertices;
+    std::vector<GLuint> m_indices;
+    std::vector<float> m_widths;
+    CacheStructure<Instance> m_instanceCache;
+    InstanceArena m_instanceArena;
+    BoundingBox m_bounds;
+  };
 
-  ///@brief makes hero trees to fill instance cache
+  ///@brief makes hero trees to fill instance cache. If m_instanceCacheDirectory is set and a seed is used, the
+  /// filled cache is saved there, and later calls with the same rules, parameters and seed load it instead
   void fillInstanceCache(int _numHeroTrees);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief hash of everything fillInstanceCache depends on (the rules, parameters, seed and number of hero trees),
+  /// used to name and check instance cache files. Must be called before addInstancingCommands changes the rules
+  //--------------------------------------------------------------------------------------------------------------------
+  uint64_t instanceCacheKey(int _numHeroTrees) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the file in m_instanceCacheDirectory for this tree, or an empty string if caches aren't being kept
+  //--------------------------------------------------------------------------------------------------------------------
+  std::string instanceCacheFileName(int _numHeroTrees) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief writes m_instanceCache, the hero geometry and m_bounds to a versioned binary file
+  /// @param [in] _fileName the file to write
+  /// @param [in] _key the instanceCacheKey() the file is for
+  /// @return false if the file couldn't be written
+  //--------------------------------------------------------------------------------------------------------------------
+  bool saveInstanceCache(const std::string &_fileName, uint64_t _key);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief memory maps a file written by saveInstanceCache and fills m_instanceCache, the hero geometry and
+  /// m_bounds from it. m_instanceCache must already have been resized for this tree
+  /// @param [in] _fileName the file to read
+  /// @param [in] _key the instanceCacheKey() the file has to match
+  /// @return false (leaving the tree unchanged) if the file is missing, corrupt or for a different tree
+  //--------------------------------------------------------------------------------------------------------------------
+  bool loadInstanceCache(const std::string &_fileName, uint64_t _key);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief makes the hero trees for fillInstanceCache on up to m_numThreads threads, each with its own seed,
+  /// geometry and instance cache, then appends them to the hero geometry and m_instanceCache in order. Trees whose '<'
+  /// branches depended on an earlier tree that changed are made again, so the result is the same as making them one
+  /// after another sharing one cache, which is what happens on one thread
+  //--------------------------------------------------------------------------------------------------------------------
+  void createHeroTrees(int _numHeroTrees);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns a copy of this L-system in forest mode without any geometry or instances, for making hero trees
+  /// and synthesised instances separately from the shared buffers
+  //--------------------------------------------------------------------------------------------------------------------
+  LSystem heroWorker() const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief marks the slots of _cache that have instances in _slots, see m_earlierHeroSlots
+  //--------------------------------------------------------------------------------------------------------------------
+  static void markFilledSlots(const CacheStructure<Instance> &_cache, std::vector<bool> &_slots);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief adds a separately made tree to the end of the hero geometry, moving its indices and instance ranges to
+  /// match, and moves its instances into m_instanceCache
+  /// @param [in] _tree the tree, whose instance cache is moved from
+  /// @param [in] _onlyEmptySlots if true, instances are only added at an id and age that has none yet, otherwise
+  /// while there's room under m_maxInstancePerLevel
+  //--------------------------------------------------------------------------------------------------------------------
+  void appendHeroTree(HeroTree &_tree, bool _onlyEmptySlots);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief simplifies the hero geometry and makes its line strips, tube mesh or quantised vertices as set by the
+  /// toggles. Called at the end of fillInstanceCache, and again whenever an instance is added afterwards
+  //--------------------------------------------------------------------------------------------------------------------
+  void finishHeroGeometry();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief makes an instance for slot (_id, _age) on its own, by deriving m_branches[_id] from generation _age and
+  /// interpreting it with _worker, then adds it (and any nested instances for empty slots) with appendHeroTree.
+  /// The turtle starts from the default state, so widths and step sizes start again from m_width and m_stepSize
+  /// @param [in] _worker a copy made by heroWorker(), reused between calls
+  /// @return true if the slot has an instance afterwards
+  //--------------------------------------------------------------------------------------------------------------------
+  bool synthesiseInstance(size_t _id, size_t _age, LSystem &_worker);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief synthesises instances for the trunk slot and every slot an exit point leads to that's still empty, until
+  /// every reachable slot is filled. Called by fillInstanceCache after the hero trees are made
+  //--------------------------------------------------------------------------------------------------------------------
+  void fillMissingInstances();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief on demand version of synthesiseInstance for a cache that's already been filled, eg. when building a
+  /// forest finds an empty slot. Finishes the hero geometry again afterwards. Calls on the same L-system are serialised
+  /// by m_synthesisMutex, but readers don't take it, so this isn't safe to call while anything else reads this
+  /// L-system's instance cache, arena or hero geometry. Forest builds each forest on one thread, from its own copies
+  /// of the L-systems, so that's single threaded as far as this is concerned
+  /// @return true if the slot has an instance afterwards
+  //--------------------------------------------------------------------------------------------------------------------
+  bool addMissingInstance(size_t _id, size_t _age);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief merges instances at the same id and age whose geometry, exit points and leaves are the same relative to
+  /// their own transform, keeping the first one and adding the others to its m_weight. Called by fillInstanceCache
+  /// before compactHeroGeometry, so the geometry of the merged instances is dropped too
+  //--------------------------------------------------------------------------------------------------------------------
+  void deduplicateInstances();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief how often each instance in m_instanceCache is expected to be drawn per tree, in forEachElement order.
+  /// The trunk is drawn once, each slot's use is shared between its instances by m_weight, and every exit point
+  /// passes its instance's use on to the slot it leads to
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<float> estimateInstanceUsage();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief decides how many instances to keep at each id and age to fit the budgets, and removes the rest. Every
+  /// filled slot keeps its most used instance, then the others are kept greedily by usage times how different they
+  /// are from the instances already kept in their slot (by size, number of indices, exit points and leaves), per
+  /// unit of budget. A removed instance's m_weight goes to the most similar kept one in its slot, so each slot is
+  /// still picked as often. Called by fillInstanceCache before compactHeroGeometry when either budget is set
+  /// @param [in] _indexBudget most indices the kept instances can draw, 0 for no limit
+  /// @param [in] _variantBudget most instances to keep, 0 for no limit
+  /// @param [in] _usage how often each instance is used, in forEachElement order, eg. counted from a forest.
+  /// Empty to use estimateInstanceUsage()
+  //--------------------------------------------------------------------------------------------------------------------
+  void optimiseInstanceVariety(size_t _indexBudget, size_t _variantBudget, std::vector<float> _usage = {});
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief removes the parts of the hero geometry that no instance in m_instanceCache uses, packing the remaining
+  /// indices and vertices down and moving the instance ranges to match, and packs m_instanceArena down to just the
+  /// exit points and leaves of the instances still in the cache. Called by fillInstanceCache, and can be
+  /// called again after instances are removed, followed by finishHeroGeometry()
+  //--------------------------------------------------------------------------------------------------------------------
+  void compactHeroGeometry();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief puts full precision hero vertices back from m_heroQuantisedVertices, if they've been quantised
+  //--------------------------------------------------------------------------------------------------------------------
+  void dequantiseHeroVertices();
 
   //PUBLIC MEMBER FUNCTIONS
   //--------------------------------------------------------------------------------------------------------------------
@@ -172,6 +461,17 @@ public://-----------------------------------------------------------------------
   /// @brief fills m_rules and m_nonTerminals
   //--------------------------------------------------------------------------------------------------------------------
   void breakDownRules(std::vector<std::string> _rules);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief sets the rule string at _index in m_ruleArray, growing the array if needed
+  //--------------------------------------------------------------------------------------------------------------------
+  void setRule(size_t _index, std::string _rule);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief reads rules from a file (one rule per line, blank lines and lines starting with # are skipped)
+  /// and uses them to fill m_ruleArray and m_rules
+  /// @param [in] _fileName the rule file to read
+  /// @return false if the file couldn't be opened
+  //--------------------------------------------------------------------------------------------------------------------
+  bool loadRules(const std::string &_fileName);
 
   //--------------------------------------------------------------------------------------------------------------------
   /// @brief recreates m_rules to add more RHSs to each rule corresponding to different instancing commands
@@ -187,18 +487,124 @@ public://-----------------------------------------------------------------------
   /// @brief returns a string representation of the tree produced by the L-System
   //--------------------------------------------------------------------------------------------------------------------
   std::string generateTreeString();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief applies the rules to _string for each generation from _firstGeneration up to m_generation, the way
+  /// generateTreeString does from the axiom
+  /// @param [in] _string the string to start from
+  /// @param [in] _firstGeneration the first generation to apply, which decides the rule used and the age of any
+  /// instancing commands it adds
+  /// @param [in] _gen the random number generator used to pick between stochastic rules
+  //--------------------------------------------------------------------------------------------------------------------
+  std::string deriveString(std::string _string, int _firstGeneration, std::default_random_engine &_gen) const;
 
   //--------------------------------------------------------------------------------------------------------------------
   /// @brief fills m_vertices and m_indices to represent the geometry of the L-System
   //--------------------------------------------------------------------------------------------------------------------
   void createGeometry();
   //--------------------------------------------------------------------------------------------------------------------
+  /// @brief generates a tree string and sends its geometry to _sink instead of m_vertices and m_indices, eg. to
+  /// write straight into a mapped buffer or a file, or just to measure the tree
+  /// @param [in] _sink the destination for the vertices and line segments
+  //--------------------------------------------------------------------------------------------------------------------
+  void createGeometry(GeometrySink &_sink);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief interprets the whole tree string in order, sending the geometry to _sink (and filling the instance
+  /// cache in forest mode)
+  //--------------------------------------------------------------------------------------------------------------------
+  void interpretTreeString(const std::string &_treeString, GeometrySink &_sink);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief splits the tree string at its top-level branches and interprets them on m_numThreads threads, then
+  /// merges the results into _sink in the same order interpretTreeString would produce them
+  /// @param [in] _treeString the string to interpret
+  /// @param [in] _sink the destination for the merged geometry
+  /// @return false if the string isn't worth splitting (or contains instancing commands), in which case nothing is done
+  //--------------------------------------------------------------------------------------------------------------------
+  bool createGeometryParallel(const std::string &_treeString, GeometrySink &_sink);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief used by createGeometry to apply a single non-instancing command from the tree string to a turtle
+  /// @param [in] _treeString the string
+  /// @param [in] _i the index of the command, moved past any parameter in brackets
+  /// @param [in] _turtle the turtle to move
+  /// @param [in] _savedTurtles the stack of turtle states saved at each '['
+  /// @param [in] _rotationCache cache of sin and cos values for the rotation commands
+  /// @param [in] _sink the destination for any new vertices and segments
+  /// @param [out] _parameterError set to true if a parameter couldn't be parsed
+  //--------------------------------------------------------------------------------------------------------------------
+  void turtleCommand(const std::string &_treeString, size_t &_i, Turtle &_turtle,
+                     std::vector<Turtle> &_savedTurtles, RotationCache &_rotationCache,
+                     GeometrySink &_sink, bool &_parameterError) const;
+
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief used by createGeometry to make a leaf from the '~' command at the turtle's position and orientation
+  /// @param [in] _treeString the string
+  /// @param [in] _i the index of the command, moved past any size parameter in brackets
+  /// @param [in] _turtle the turtle placing the leaf
+  /// @param [out] _parameterError set to true if the size couldn't be parsed
+  //--------------------------------------------------------------------------------------------------------------------
+  Instance::Leaf createLeaf(const std::string &_treeString, size_t &_i, const Turtle &_turtle,
+                            bool &_parameterError) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief grows _bounds to contain the whole of a leaf card
+  //--------------------------------------------------------------------------------------------------------------------
+  void expandByLeaf(BoundingBox &_bounds, const Instance::Leaf &_leaf) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief builds a tube mesh from line geometry, replacing each segment with a pair of rings of m_tubeSides
+  /// vertices (with radius taken from _widths) joined by triangles. Every segment gets the same number of tube
+  /// indices, so index ranges in the line geometry map straight onto the tube mesh using tubeIndex()
+  /// @param [in] _vertices, _widths, _indices the line geometry
+  /// @param [out] _tubeVertices, _tubeIndices the tube mesh
+  //--------------------------------------------------------------------------------------------------------------------
+  void createTubeMesh(const std::vector<ngl::Vec3> &_vertices, const std::vector<float> &_widths,
+                      const std::vector<GLuint> &_indices,
+                      std::vector<ngl::Vec3> &_tubeVertices, std::vector<GLuint> &_tubeIndices) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief merges consecutive segments into one where the vertex between them only joins those two segments,
+  /// the widths match and the direction stays within m_simplifyAngle of the start of the run. Branch points are
+  /// never removed, and unused vertices are packed down so the vertex order is otherwise unchanged
+  /// @param [in] _vertices, _indices, _widths the line geometry to simplify in place
+  /// @param [in] _boundaries index list positions (eg. instance starts and ends) that segments can't be merged
+  /// across, updated to the matching positions in the simplified index list
+  //--------------------------------------------------------------------------------------------------------------------
+  void simplifyGeometry(std::vector<ngl::Vec3> &_vertices, std::vector<GLuint> &_indices,
+                        std::vector<float> &_widths, const std::vector<size_t*> &_boundaries) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief converts GL_LINES index pairs into line strips, starting a new strip (after RESTART_INDEX) whenever a
+  /// segment doesn't continue from the end of the previous one
+  /// @param [in] _indices the line index pairs
+  /// @param [out] _stripIndices the line strip indices
+  /// @param [in] _boundaries index list positions (eg. instance starts and ends) that always start a new strip
+  /// @param [out] _stripBoundaries the matching positions in _stripIndices
+  //--------------------------------------------------------------------------------------------------------------------
+  void createLineStrips(const std::vector<GLuint> &_indices, std::vector<GLuint> &_stripIndices,
+                        const std::vector<size_t> &_boundaries, std::vector<size_t> &_stripBoundaries) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief fills m_heroQuantisedVertices, m_heroQuantiseCentre and m_heroQuantiseScale from m_heroVertices, then
+  /// empties m_heroVertices
+  //--------------------------------------------------------------------------------------------------------------------
+  void quantiseHeroVertices();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns hero vertex _index at full precision, whether or not the hero vertices have been quantised
+  //--------------------------------------------------------------------------------------------------------------------
+  ngl::Vec3 heroVertex(size_t _index) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief folds the dequantisation of the hero vertices into an instance transform, so the quantised positions
+  /// can be drawn directly with the result
+  /// @param [in] _transform the instance transform used for full precision vertices
+  //--------------------------------------------------------------------------------------------------------------------
+  ngl::Mat4 dequantiseTransform(const ngl::Mat4 &_transform) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief converts a position in the line index list (eg. an instance's m_instanceStart) to the matching
+  /// position in the tube index list
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t tubeIndex(size_t _lineIndex) const;
+  //--------------------------------------------------------------------------------------------------------------------
   /// @brief used by createGeometry to deal with parameters enclosed by brackets in the tree string
   /// @param [in] _treeString the string
   /// @param [in] _i the index of _treeString that createGeometry() has reached
   /// @param [in] _paramVar the variable that will be replaced by the parameter in the brackets if needed
+  /// @param [out] _parameterError set to true if the parameter couldn't be parsed
   //--------------------------------------------------------------------------------------------------------------------
-  void parseBrackets(const std::string &_treeString, size_t &_i, float &_paramVar);
+  void parseBrackets(const std::string &_treeString, size_t &_i, float &_paramVar, bool &_parameterError) const;
 
   void parseInstanceBrackets(const std::string &_treeString, size_t &_i, size_t &_id, size_t &_age);
   void skipToNextChevron(const std::string &_treeString, size_t &_i);
@@ -203,6 +203,16 @@ protected:
   //as above: separated by treeType/id/age/innerIndex
   //std::vector<std::vector<std::vector<std::vector<GLuint>>>> m_bufferIds;
   std::vector<CacheStructure<GLuint>> m_bufferIds;
+  //the transforms drawn for each cached instance, as above, with any dequantisation already folded in
+  std::vector<CacheStructure<std::vector<ngl::Mat4>>> m_instanceTransforms;
+
+  //one instanced leaf card VAO per tree type, and the buffers holding their leaf transforms
+  std::vector<std::unique_ptr<ngl::AbstractVAO>> m_leafVAOs;
+  std::vector<GLuint> m_leafBufferIds;
+
+  //VAOs and transform buffers for the hybrid mode trees in m_forest.m_uniqueTrees
+  std::vector<std::unique_ptr<ngl::AbstractVAO>> m_uniqueTreeVAOs;
+  std::vector<GLuint> m_uniqueTreeBufferIds;
 
   //----------------------------------------------------------------------------------------------------------------------
   /// @brief the forest object to be sent to the renderer
@@ -257,11 +267,37 @@ protected:
   void resizeGL(int _w, int _h) override;
   //----------------------------------------------------------------------------------------------------------------------
   /// @brief build an openGL line VAO from lists of vertices and indices (used by paintGL)
+  /// @param [in] _mode the primitive to draw, GL_TRIANGLES is used for tube meshes
+  //----------------------------------------------------------------------------------------------------------------------
+  void buildLineVAO(std::vector<ngl::Vec3> &_vertices, std::vector<GLuint> &_indices,
+                    std::unique_ptr<ngl::AbstractVAO> &_vao, GLenum _mode=GL_LINES);
   //----------------------------------------------------------------------------------------------------------------------
-  void buildLineVAO(std::vector<ngl::Vec3> &_vertices, std::vector<GLshort> &_indices,
-                    std::unique_ptr<ngl::AbstractVAO> &_vao);
+  /// @brief build the VAO for an L-System tab, from its tube mesh if m_tubeMode is set, its line strips if
+  /// m_stripMode is set or its lines otherwise
+  //----------------------------------------------------------------------------------------------------------------------
+  void buildLSystemVAO(LSystem &_LSystem, std::unique_ptr<ngl::AbstractVAO> &_vao);
 
   void buildInstanceCacheVAO(LSystem &_treeType, Instance &_instance, std::unique_ptr<ngl::AbstractVAO> &_vao);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief build an instanced VAO drawing a leaf card at each of _transforms, uploading the transforms once
+  /// @param [in] _transforms the world transforms of the leaves (from Forest::m_leafOutput)
+  /// @param [out] _vao the VAO to build
+  /// @param [out] _transformBuffer the buffer the transforms are uploaded to
+  //----------------------------------------------------------------------------------------------------------------------
+  void buildLeafVAO(std::vector<ngl::Mat4> &_transforms, std::unique_ptr<ngl::AbstractVAO> &_vao,
+                    GLuint &_transformBuffer);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief build a VAO drawing the geometry of a hybrid mode tree with its tree transform
+  //----------------------------------------------------------------------------------------------------------------------
+  void buildUniqueTreeVAO(Forest::UniqueTree &_uniqueTree, std::unique_ptr<ngl::AbstractVAO> &_vao,
+                          GLuint &_transformBuffer);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief build an instanced VAO drawing _vertices and _indices once for each of _transforms, which are uploaded
+  /// to _transformBuffer (generated if it's 0) for the ForestShader
+  //----------------------------------------------------------------------------------------------------------------------
+  void buildInstancedVAO(std::vector<ngl::Vec3> &_vertices, std::vector<GLuint> &_indices,
+                         std::vector<ngl::Mat4> &_transforms, std::unique_ptr<ngl::AbstractVAO> &_vao,
+                         GLuint &_transformBuffer, GLenum _mode);
 
   std::unique_ptr<ngl::AbstractVAO> m_testVao;
   //void buildTestVAO(LSystem &_treeType, Instance &_instance, std::unique_ptr<ngl::AbstractVAO> &_vao, size_t _instanceCount);
@@ -271,8 +307,8 @@ protected:
   {
   public:
     buildTestVAO(LSystem &_treeType, CacheStructure<std::vector<ngl::Mat4>> &_outputCacheData);
-    LSystem m_treeType;
-    CacheStructure<std::vector<ngl::Mat4>> m_outputCacheData;
+    LSystem &m_treeType;
+    CacheStructure<std::vector<ngl::Mat4>> &m_outputCacheData;
 
     void operator () (std::unique_ptr<ngl::AbstractVAO> &_vao, size_t &_id, size_t &_age, size_t &_innerIndex);
   };
@@ -281,9 +317,11 @@ protected:
   class drawInstanceVAO
   {
   public:
-    drawInstanceVAO(CacheStructure<std::vector<ngl::Mat4>> &_outputCacheData, CacheStructure<GLuint> &_bufferIds);
-    CacheStructure<std::vector<ngl::Mat4>> m_outputCacheData;
-    CacheStructure<GLuint> m_bufferIds;
+    drawInstanceVAO(LSystem &_treeType, CacheStructure<std::vector<ngl::Mat4>> &_outputCacheData,
+                    CacheStructure<GLuint> &_bufferIds);
+    LSystem &m_treeType;
+    CacheStructure<std::vector<ngl::Mat4>> &m_outputCacheData;
+    CacheStructure<GLuint> &m_bufferIds;
 
     void operator () (std::unique_ptr<ngl::AbstractVAO> &_vao, size_t &_id, size_t &_age, size_t &_innerIndex);
   };
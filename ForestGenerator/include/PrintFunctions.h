@@ -36,7 +36,7 @@ void print(ngl::Mat3 _m);
 void print(ngl::Vec3 _v);
 
 void print(std::vector<float> _vec);
-void print(std::vector<GLshort> _vec);
+void print(std::vector<GLuint> _vec);
 void print(std::vector<std::string> _vec);
 void print(std::vector<ngl::Mat4> _vec);
 void print(std::vector<ngl::Mat3> _vec);
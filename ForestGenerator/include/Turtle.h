@@ -0,0 +1,105 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file Turtle.h
+/// @author Ben Carey
+/// @version 1.0
+/// @date 19/10/19
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifndef TURTLE_H_
+#define TURTLE_H_
+
+#include <unordered_map>
+#include <utility>
+#include <ngl/Vec3.h>
+#include <ngl/Mat4.h>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class Turtle
+/// @brief this struct stores the state of the turtle used by LSystem::createGeometry to interpret the tree string.
+/// The orientation is stored as an orthonormal frame (m_right, m_dir and their cross product), so rotations
+/// only need a sin/cos pair rather than a full rotation matrix
+//----------------------------------------------------------------------------------------------------------------------
+
+struct Turtle
+{
+  //CONSTRUCTOR
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief default ctor for Turtle struct
+  //--------------------------------------------------------------------------------------------------------------------
+  Turtle() = default;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief ctor for Turtle struct, starting at the origin facing up the y axis
+  //--------------------------------------------------------------------------------------------------------------------
+  Turtle(float _stepSize, float _angle, float _width, GLuint _lastIndex);
+
+  //MEMBER VARIABLES
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief current position of the turtle, ie. the last vertex added
+  //--------------------------------------------------------------------------------------------------------------------
+  ngl::Vec3 m_lastVertex = ngl::Vec3(0,0,0);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief direction the turtle moves in
+  //--------------------------------------------------------------------------------------------------------------------
+  ngl::Vec3 m_dir = ngl::Vec3(0,1,0);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief axis the turtle pitches around, always perpendicular to m_dir
+  //--------------------------------------------------------------------------------------------------------------------
+  ngl::Vec3 m_right = ngl::Vec3(1,0,0);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief current step size and rotation angle
+  //--------------------------------------------------------------------------------------------------------------------
+  float m_stepSize = 1;
+  float m_angle = 0;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief current branch width, scaled by the '!' command and recorded for each vertex for the tube mesh
+  //--------------------------------------------------------------------------------------------------------------------
+  float m_width = 1;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief index of m_lastVertex in the vertex list
+  //--------------------------------------------------------------------------------------------------------------------
+  GLuint m_lastIndex = 0;
+
+  //METHODS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief rotate m_right around m_dir (roll) by the angle with the given sin and cos
+  //--------------------------------------------------------------------------------------------------------------------
+  void roll(float _sin, float _cos);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief rotate m_dir around m_right (pitch) by the angle with the given sin and cos
+  //--------------------------------------------------------------------------------------------------------------------
+  void pitch(float _sin, float _cos);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns the matrix mapping local turtle space to world space, as used by the instancing commands
+  //--------------------------------------------------------------------------------------------------------------------
+  ngl::Mat4 transform() const;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class RotationCache
+/// @brief caches sin and cos of every angle (in degrees) the turtle has rotated by, since tree strings use the same
+/// few angles over and over again
+//----------------------------------------------------------------------------------------------------------------------
+
+class RotationCache
+{
+public:
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief gets sin and cos of _angle, only calling the trig functions the first time _angle is seen
+  /// @param [in] _angle the angle in degrees
+  //--------------------------------------------------------------------------------------------------------------------
+  void getSinCos(float _angle, float &_sin, float &_cos);
+
+private:
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the most recent lookup, checked before the map since consecutive rotations usually share an angle
+  //--------------------------------------------------------------------------------------------------------------------
+  float m_lastAngle = 0;
+  std::pair<float,float> m_lastSinCos = {0,1};
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief map from angle to (sin, cos)
+  //--------------------------------------------------------------------------------------------------------------------
+  std::unordered_map<float,std::pair<float,float>> m_cache;
+};
+
+
+#endif //TURTLE_H_
@@ -0,0 +1,71 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file BoundingBox.cpp
+/// @brief implementation file for BoundingBox struct
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cfloat>
+#include <math.h>
+#include "BoundingBox.h"
+
+BoundingBox::BoundingBox() :
+  m_min(FLT_MAX, FLT_MAX, FLT_MAX), m_max(-FLT_MAX, -FLT_MAX, -FLT_MAX) {}
+
+void BoundingBox::expand(const ngl::Vec3 &_point)
+{
+  m_min.m_x = std::min(m_min.m_x, _point.m_x);
+  m_min.m_y = std::min(m_min.m_y, _point.m_y);
+  m_min.m_z = std::min(m_min.m_z, _point.m_z);
+  m_max.m_x = std::max(m_max.m_x, _point.m_x);
+  m_max.m_y = std::max(m_max.m_y, _point.m_y);
+  m_max.m_z = std::max(m_max.m_z, _point.m_z);
+}
+
+void BoundingBox::expand(const BoundingBox &_box)
+{
+  if(_box.isEmpty() == false)
+  {
+    expand(_box.m_min);
+    expand(_box.m_max);
+  }
+}
+
+bool BoundingBox::isEmpty() const
+{
+  return m_min.m_x > m_max.m_x;
+}
+
+ngl::Vec3 BoundingBox::centre() const
+{
+  return 0.5f*(m_min+m_max);
+}
+
+float BoundingBox::radius() const
+{
+  return isEmpty() ? 0.0f : 0.5f*(m_max-m_min).length();
+}
+
+BoundingBox BoundingBox::transformed(const ngl::Mat4 &_transform) const
+{
+  BoundingBox box;
+  if(isEmpty())
+  {
+    return box;
+  }
+  //the new box is the transformed centre, plus the absolute value of the transform applied to the half extent
+  ngl::Vec3 centre = this->centre();
+  ngl::Vec3 halfExtent = 0.5f*(m_max-m_min);
+  for(int col=0; col<3; col++)
+  {
+    float c = _transform.m_m[3][col];
+    float e = 0.0f;
+    for(int row=0; row<3; row++)
+    {
+      c += centre[row]*_transform.m_m[row][col];
+      e += halfExtent[row]*fabsf(_transform.m_m[row][col]);
+    }
+    box.m_min[col] = c-e;
+    box.m_max[col] = c+e;
+  }
+  return box;
+}
@@ -5,6 +5,8 @@
 
 #include <math.h>
 #include <chrono>
+#include <atomic>
+#include <thread>
 #include "Forest.h"
 
 Forest::Forest(const std::vector<LSystem> &_treeTypes, float _width, float _length, size_t _numTrees, int _numHeroTrees) :
@@ -12,9 +14,51 @@ Forest::Forest(const std::vector<LSystem> &_treeTypes, float _width, float _leng
 {
   scatterForest();
 
+  //keep untouched copies of the tree types for hybrid mode, without the geometry they were last drawn with
+  m_uniqueTreeTypes = m_treeTypes;
+  for(auto &treeType : m_uniqueTreeTypes)
+  {
+    treeType.m_vertices = {};
+    treeType.m_indices = {};
+    treeType.m_widths = {};
+    treeType.m_tubeVertices = {};
+    treeType.m_tubeIndices = {};
+    treeType.m_stripIndices = {};
+    treeType.m_leaves = {};
+    treeType.m_numThreads = 1;
+  }
+
+  //the tree types are independent, so they're filled at the same time, with the threads shared out between them
+  //for making their hero trees
+  size_t numThreads = std::max(size_t(1), size_t(std::thread::hardware_concurrency()));
+  size_t numTypeThreads = std::min(numThreads, m_treeTypes.size());
+  std::vector<size_t> savedNumThreads = {};
   for(auto &treeType : m_treeTypes)
   {
-    treeType.fillInstanceCache(m_numHeroTrees);
+    savedNumThreads.push_back(treeType.m_numThreads);
+    treeType.m_numThreads = std::max(size_t(1), std::min(treeType.m_numThreads, numThreads/std::max(size_t(1), numTypeThreads)));
+  }
+  std::atomic<size_t> nextType(0);
+  auto fillTypes = [&]()
+  {
+    for(size_t t=nextType++; t<m_treeTypes.size(); t=nextType++)
+    {
+      m_treeTypes[t].fillInstanceCache(m_numHeroTrees);
+    }
+  };
+  std::vector<std::thread> threads = {};
+  for(size_t t=1; t<numTypeThreads; t++)
+  {
+    threads.push_back(std::thread(fillTypes));
+  }
+  fillTypes();
+  for(auto &thread : threads)
+  {
+    thread.join();
+  }
+  for(size_t t=0; t<m_treeTypes.size(); t++)
+  {
+    m_treeTypes[t].m_numThreads = savedNumThreads[t];
   }
 
   resizeOutputCache();
@@ -36,10 +80,46 @@ void Forest::resizeOutputCache()
 {
   m_outputCache={};
   m_outputCache.resize(m_treeTypes.size());
+  m_leafOutput={};
+  m_leafOutput.resize(m_treeTypes.size());
   for(size_t t=0; t<m_treeTypes.size(); t++)
   {
     m_outputCache[t].resizeCache(m_treeTypes[t].m_instanceCache);
   }
+  //plans refer to inner indices, which change whenever the output cache needs resizing
+  m_expansionPlans={};
+  m_expansionPlans.resize(m_treeTypes.size());
+  m_expansionPlanArenas={};
+  m_expansionPlanArenas.resize(m_treeTypes.size());
+  for(size_t t=0; t<m_treeTypes.size(); t++)
+  {
+    m_expansionPlans[t].resizeCache(m_treeTypes[t].m_instanceCache);
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void Forest::syncOutputCache(size_t _treeType)
+{
+  //instances are only ever added to empty slots after the cache is filled, so every existing element keeps its id,
+  //age and inner index and its transforms can be moved across as they are
+  CacheStructure<std::vector<ngl::Mat4>> &outputCache = m_outputCache[_treeType];
+  CacheStructure<std::vector<ngl::Mat4>> synced;
+  synced.resizeCache(m_treeTypes[_treeType].m_instanceCache);
+  outputCache.forEachElement([&](std::vector<ngl::Mat4> &_transforms, size_t _id, size_t _age, size_t _innerIndex)
+  {
+    synced.setElement(_id, _age, _innerIndex, std::move(_transforms));
+  });
+  outputCache = std::move(synced);
+
+  CacheStructure<std::vector<ExpansionPlan>> &plans = m_expansionPlans[_treeType];
+  CacheStructure<std::vector<ExpansionPlan>> syncedPlans;
+  syncedPlans.resizeCache(m_treeTypes[_treeType].m_instanceCache);
+  plans.forEachElement([&](std::vector<ExpansionPlan> &_plans, size_t _id, size_t _age, size_t _innerIndex)
+  {
+    syncedPlans.setElement(_id, _age, _innerIndex, std::move(_plans));
+  });
+  plans = std::move(syncedPlans);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -85,25 +165,75 @@ void Forest::scatterForest()
 
 //----------------------------------------------------------------------------------------------------------------------
 
-void Forest::createTree(size_t _treeType, ngl::Mat4 _transform, size_t _id, size_t _age)
+void Forest::createTree(size_t _treeType, ngl::Mat4 _transform, size_t _id, size_t _age, BoundingBox &_treeBounds)
 {
   LSystem &treeType = m_treeTypes[_treeType];
   size_t size = treeType.m_instanceCache.numInstancesAt(_id,_age);
+  //none of the hero trees reached this slot, so make an instance for it now
+  if(size == 0 && treeType.addMissingInstance(_id,_age))
+  {
+    syncOutputCache(_treeType);
+    size = treeType.m_instanceCache.numInstancesAt(_id,_age);
+  }
   if(size>0)
   {
     size_t innerIndex = 0;
     Instance * instance = getInstance(treeType, _id, _age, innerIndex);
-    ngl::Mat4 T = _transform * instance->m_transform.inverse();
-    m_output.push_back(OutputData(T, _treeType, _id, _age, innerIndex));
-    std::vector<ngl::Mat4> * transforms = m_outputCache[_treeType].getElement(_id,_age,innerIndex);
-    transforms->push_back(T);
-    for(size_t i=0; i<instance->m_exitPoints.size(); i++)
+    //plans one level deep wouldn't pick anything, so there's nothing to gain over walking the tree as it's reached
+    if(m_expansionPlanDepth <= 1)
+    {
+      outputInstance(_treeType, _transform * instance->m_inverseTransform, _id, _age, innerIndex, instance->m_bounds,
+                     _treeBounds);
+      for(auto &leaf : treeType.m_instanceArena.leaves(*instance))
+      {
+        m_leafOutput[_treeType].push_back(_transform * leaf.transform());
+      }
+      size_t numExitPoints = instance->m_numExitPoints;
+      for(size_t i=0; i<numExitPoints; i++)
+      {
+        //an instance added further down the tree can move the cache's elements and the arena, so look this one's exit
+        //point up again each time
+        instance = treeType.m_instanceCache.getElement(_id,_age,innerIndex);
+        Instance::ExitPoint exitPoint = treeType.m_instanceArena.exitPoints(*instance)[i];
+        createTree(_treeType, _transform * exitPoint.m_exitTransform, exitPoint.m_exitId, exitPoint.m_exitAge,
+                   _treeBounds);
+      }
+      return;
+    }
+
+    size_t numVariants = std::max(size_t(1), m_numExpansionPlanVariants);
+    std::vector<ExpansionPlan> *plans = m_expansionPlans[_treeType].getElement(_id,_age,innerIndex);
+    if(plans->size() != numVariants)
+    {
+      plans->assign(numVariants, ExpansionPlan());
+    }
+    size_t variant = 0;
+    if(numVariants > 1)
     {
-      size_t newAge = instance->m_exitPoints[i].m_exitAge;
-      size_t newId = instance->m_exitPoints[i].m_exitId;
-      ngl::Mat4 exitTransform = instance->m_exitPoints[i].m_exitTransform;
-      ngl::Mat4 newTransform = _transform * exitTransform;
-      createTree(_treeType, newTransform, newId, newAge);
+      std::uniform_int_distribution<size_t> dist(0,numVariants-1);
+      variant = dist(m_gen);
+    }
+    if((*plans)[variant].m_isBuilt == false)
+    {
+      buildExpansionPlan(_treeType, _id, _age, innerIndex, variant);
+    }
+    //the plan's ranges stay put while more plans are added to the arena further down the tree
+    ExpansionPlan plan = (*m_expansionPlans[_treeType].getElement(_id,_age,innerIndex))[variant];
+    ExpansionPlanArena &arena = m_expansionPlanArenas[_treeType];
+    for(size_t i=plan.m_firstInstance; i<plan.m_firstInstance+plan.m_numInstances; i++)
+    {
+      const OutputData &planned = arena.m_instances[i];
+      outputInstance(_treeType, _transform * planned.m_transform, planned.m_id, planned.m_age, planned.m_innerIndex,
+                     planned.m_bounds, _treeBounds);
+    }
+    for(size_t i=plan.m_firstLeaf; i<plan.m_firstLeaf+plan.m_numLeaves; i++)
+    {
+      m_leafOutput[_treeType].push_back(_transform * arena.m_leaves[i]);
+    }
+    for(size_t i=plan.m_firstExitPoint; i<plan.m_firstExitPoint+plan.m_numExitPoints; i++)
+    {
+      Instance::ExitPoint exitPoint = arena.m_exitPoints[i];
+      createTree(_treeType, _transform * exitPoint.m_exitTransform, exitPoint.m_exitId, exitPoint.m_exitAge, _treeBounds);
     }
   }
   else
@@ -112,12 +242,103 @@ void Forest::createTree(size_t _treeType, ngl::Mat4 _transform, size_t _id, size
   }
 }
 
+//----------------------------------------------------------------------------------------------------------------------
+
+void Forest::outputInstance(size_t _treeType, const ngl::Mat4 &_transform, size_t _id, size_t _age,
+                            size_t _innerIndex, const BoundingBox &_bounds, BoundingBox &_treeBounds)
+{
+  m_output.push_back(OutputData(_transform, _treeType, _id, _age, _innerIndex));
+  //instance bounds are in the same space as the hero vertices, so the transform takes them straight to world space
+  m_output.back().m_bounds = _bounds.transformed(_transform);
+  _treeBounds.expand(m_output.back().m_bounds);
+  m_outputCache[_treeType].getElement(_id,_age,_innerIndex)->push_back(_transform);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void Forest::buildExpansionPlan(size_t _treeType, size_t _id, size_t _age, size_t _innerIndex, size_t _variant)
+{
+  //nothing else is added to the arena while the plan is built, so it ends up as one range of each array
+  ExpansionPlanArena &arena = m_expansionPlanArenas[_treeType];
+  ExpansionPlan plan;
+  plan.m_isBuilt = true;
+  plan.m_firstInstance = arena.m_instances.size();
+  plan.m_firstLeaf = arena.m_leaves.size();
+  plan.m_firstExitPoint = arena.m_exitPoints.size();
+  addToExpansionPlan(_treeType, ngl::Mat4(), _id, _age, _innerIndex, 1);
+  plan.m_numInstances = arena.m_instances.size()-plan.m_firstInstance;
+  plan.m_numLeaves = arena.m_leaves.size()-plan.m_firstLeaf;
+  plan.m_numExitPoints = arena.m_exitPoints.size()-plan.m_firstExitPoint;
+  //filling an empty slot on the way down reshapes m_expansionPlans, so the plan is only stored once it's finished
+  (*m_expansionPlans[_treeType].getElement(_id,_age,_innerIndex))[_variant] = plan;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void Forest::addToExpansionPlan(size_t _treeType, ngl::Mat4 _transform, size_t _id, size_t _age, size_t _innerIndex,
+                                size_t _level)
+{
+  ExpansionPlanArena &arena = m_expansionPlanArenas[_treeType];
+  LSystem &treeType = m_treeTypes[_treeType];
+  const Instance *instance = treeType.m_instanceCache.getElement(_id,_age,_innerIndex);
+  arena.m_instances.push_back(OutputData(_transform * instance->m_inverseTransform, _treeType, _id, _age, _innerIndex));
+  arena.m_instances.back().m_bounds = instance->m_bounds;
+  for(auto &leaf : treeType.m_instanceArena.leaves(*instance))
+  {
+    arena.m_leaves.push_back(_transform * leaf.transform());
+  }
+  //copied, since filling an empty slot below can move the arena
+  auto exitRange = treeType.m_instanceArena.exitPoints(*instance);
+  std::vector<Instance::ExitPoint> exitPoints(exitRange.begin(), exitRange.end());
+  for(auto &exitPoint : exitPoints)
+  {
+    ngl::Mat4 newTransform = _transform * exitPoint.m_exitTransform;
+    size_t size = 0;
+    if(_level < m_expansionPlanDepth)
+    {
+      size = treeType.m_instanceCache.numInstancesAt(exitPoint.m_exitId,exitPoint.m_exitAge);
+      if(size == 0 && treeType.addMissingInstance(exitPoint.m_exitId,exitPoint.m_exitAge))
+      {
+        syncOutputCache(_treeType);
+        size = treeType.m_instanceCache.numInstancesAt(exitPoint.m_exitId,exitPoint.m_exitAge);
+      }
+    }
+    //past the last level, or still empty, in which case createTree reports it
+    if(size == 0)
+    {
+      arena.m_exitPoints.push_back(Instance::ExitPoint(exitPoint.m_exitId, exitPoint.m_exitAge, newTransform));
+      continue;
+    }
+    size_t innerIndex = 0;
+    getInstance(treeType, exitPoint.m_exitId, exitPoint.m_exitAge, innerIndex);
+    addToExpansionPlan(_treeType, newTransform, exitPoint.m_exitId, exitPoint.m_exitAge, innerIndex, _level+1);
+  }
+}
+
 Instance * Forest::getInstance(LSystem &_treeType, size_t _id, size_t _age, size_t &_innerIndex)
 {
-  size_t size = _treeType.m_instanceCache.numInstancesAt(_id,_age);
-  std::uniform_int_distribution<size_t> dist(0,size-1);
-  _innerIndex = dist(m_gen);
-  return _treeType.m_instanceCache.getElement(_id,_age,_innerIndex);
+  //merged duplicates are picked as often as the instances they replaced, so with no merges this is the same as
+  //picking uniformly
+  //the slot is looked up once, and its instances are one contiguous run once everything pushed has been merged
+  CacheStructure<Instance> &cache = _treeType.m_instanceCache;
+  cache.mergePushedElements();
+  size_t s = cache.findSlot(_id,_age);
+  Instance *instances = &cache.m_elements[cache.m_offsets[s]];
+  size_t size = cache.m_offsets[s+1]-cache.m_offsets[s];
+  size_t totalWeight = 0;
+  for(size_t i=0; i<size; i++)
+  {
+    totalWeight += instances[i].m_weight;
+  }
+  std::uniform_int_distribution<size_t> dist(0,totalWeight-1);
+  size_t choice = dist(m_gen);
+  _innerIndex = 0;
+  while(choice >= instances[_innerIndex].m_weight)
+  {
+    choice -= instances[_innerIndex].m_weight;
+    _innerIndex++;
+  }
+  return &instances[_innerIndex];
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -129,5 +350,147 @@ void Forest::createForest()
   m_output = {};
   resizeOutputCache();
   for(auto &tree : m_treeData)
-    createTree(tree.m_type,tree.m_transform,0,0);
+  {
+    tree.m_isUnique = false;
+  }
+  m_uniqueTrees = {};
+  if(m_hybridMode)
+  {
+    createUniqueTrees();
+  }
+  for(auto &tree : m_treeData)
+  {
+    if(tree.m_isUnique == false)
+    {
+      tree.m_bounds = BoundingBox();
+      createTree(tree.m_type,tree.m_transform,0,0,tree.m_bounds);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void Forest::optimiseInstanceVariety(size_t _indexBudget, size_t _variantBudget)
+{
+  std::vector<std::vector<float>> usage(m_treeTypes.size());
+  std::vector<size_t> numDrawn(m_treeTypes.size(), 0);
+  size_t totalDrawn = 0;
+  for(size_t t=0; t<m_treeTypes.size(); t++)
+  {
+    m_outputCache[t].forEachElement([&](std::vector<ngl::Mat4> &_transforms, size_t, size_t, size_t)
+    {
+      usage[t].push_back(float(_transforms.size()));
+      numDrawn[t] += _transforms.size();
+    });
+    totalDrawn += numDrawn[t];
+  }
+  if(totalDrawn == 0)
+  {
+    return;
+  }
+
+  auto share = [&](size_t _budget, size_t _treeType)
+  {
+    return _budget == 0 ? 0 : std::max(size_t(1), _budget*numDrawn[_treeType]/totalDrawn);
+  };
+  for(size_t t=0; t<m_treeTypes.size(); t++)
+  {
+    LSystem &treeType = m_treeTypes[t];
+    treeType.optimiseInstanceVariety(share(_indexBudget,t), share(_variantBudget,t), usage[t]);
+    treeType.compactHeroGeometry();
+    treeType.finishHeroGeometry();
+  }
+
+  //the inner indices the output refers to have changed
+  resizeOutputCache();
+  createForest();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void Forest::createUniqueTrees()
+{
+  if(m_uniqueTreeTypes.size() != m_treeTypes.size())
+  {
+    std::cerr<<"WARNING: no unique tree types available, using instances for every tree \n";
+    return;
+  }
+
+  //nearest trees first, so if the budget runs out it's the furthest ones that fall back to instancing
+  std::vector<size_t> order(m_treeData.size());
+  for(size_t i=0; i<order.size(); i++)
+  {
+    order[i] = i;
+  }
+  auto distance = [&](size_t _tree)
+  {
+    const ngl::Mat4 &transform = m_treeData[_tree].m_transform;
+    return (ngl::Vec3(transform.m_30, transform.m_31, transform.m_32)-m_focusPoint).lengthSquared();
+  };
+  size_t numUnique = std::min(m_numUniqueTrees, order.size());
+  std::partial_sort(order.begin(), order.begin()+long(numUnique), order.end(),
+                    [&](size_t _a, size_t _b){ return distance(_a) < distance(_b); });
+  order.resize(numUnique);
+
+  //each tree gets its own seed, so the result doesn't depend on which thread makes it
+  size_t baseSeed = m_useSeed ? m_seed : size_t(std::chrono::system_clock::now().time_since_epoch().count());
+
+  std::vector<UniqueTree> uniqueTrees(numUnique);
+  std::vector<std::vector<Instance::Leaf>> leaves(numUnique);
+  std::vector<BoundingBox> bounds(numUnique);
+  //char rather than bool, since different threads write to neighbouring elements
+  std::vector<char> done(numUnique, false);
+  std::atomic<size_t> nextTree(0);
+  auto start = std::chrono::steady_clock::now();
+  auto createTrees = [&]()
+  {
+    for(size_t i=nextTree++; i<numUnique; i=nextTree++)
+    {
+      std::chrono::duration<float> elapsed = std::chrono::steady_clock::now()-start;
+      if(elapsed.count() > m_uniqueTreeBudget)
+      {
+        break;
+      }
+      const Tree &tree = m_treeData[order[i]];
+      LSystem generator = m_uniqueTreeTypes[tree.m_type];
+      generator.m_gen.seed(baseSeed+order[i]);
+      generator.createGeometry();
+
+      UniqueTree &uniqueTree = uniqueTrees[i];
+      uniqueTree.m_treeIndex = order[i];
+      uniqueTree.m_isTubeMesh = generator.m_tubeMode;
+      uniqueTree.m_vertices = std::move(generator.m_tubeMode ? generator.m_tubeVertices : generator.m_vertices);
+      uniqueTree.m_indices = std::move(generator.m_tubeMode ? generator.m_tubeIndices : generator.m_indices);
+      leaves[i] = std::move(generator.m_leaves);
+      bounds[i] = generator.m_bounds;
+      done[i] = true;
+    }
+  };
+
+  size_t numThreads = std::min(size_t(std::max(1u, std::thread::hardware_concurrency())), numUnique);
+  std::vector<std::thread> threads = {};
+  for(size_t t=1; t<numThreads; t++)
+  {
+    threads.push_back(std::thread(createTrees));
+  }
+  createTrees();
+  for(auto &thread : threads)
+  {
+    thread.join();
+  }
+
+  for(size_t i=0; i<numUnique; i++)
+  {
+    if(done[i])
+    {
+      Tree &tree = m_treeData[order[i]];
+      tree.m_isUnique = true;
+      tree.m_bounds = bounds[i].transformed(tree.m_transform);
+      for(auto &leaf : leaves[i])
+      {
+        m_leafOutput[tree.m_type].push_back(tree.m_transform * leaf.transform());
+      }
+      m_uniqueTrees.push_back(std::move(uniqueTrees[i]));
+    }
+  }
 }
@@ -0,0 +1,155 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file Forest_Tuning.cpp
+/// @brief implementation file for Forest class tuneInstancing function
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <utility>
+#include "Forest.h"
+
+//bytes of the arrays the scene uploads for a tree type's hero geometry
+template<class T>
+static size_t bytesOf(const std::vector<T> &_vector)
+{
+  return _vector.size()*sizeof(T);
+}
+
+static size_t heroGeometryBytes(const LSystem &_treeType)
+{
+  if(_treeType.m_tubeMode)
+  {
+    return bytesOf(_treeType.m_heroTubeVertices) + bytesOf(_treeType.m_heroTubeIndices);
+  }
+  size_t bytes = _treeType.m_heroQuantisedVertices.empty() ? bytesOf(_treeType.m_heroVertices) :
+                                                             bytesOf(_treeType.m_heroQuantisedVertices);
+  bytes += bytesOf(_treeType.m_heroWidths);
+  return bytes + (_treeType.m_stripMode ? bytesOf(_treeType.m_heroStripIndices) : bytesOf(_treeType.m_heroIndices));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+Forest::TuningSample Forest::tuneInstancing(LSystem &_species, const TuningTargets &_targets,
+                                            std::vector<TuningSample> *_samples)
+{
+  std::vector<TuningSample> samples = {};
+  for(auto instancingProb : _targets.m_instancingProbs)
+  {
+    for(auto maxInstancePerLevel : _targets.m_maxInstancesPerLevel)
+    {
+      TuningSample sample = {instancingProb, maxInstancePerLevel, 0, 0, 0.0f, 0.0f};
+      samples.push_back(sample);
+    }
+  }
+  if(samples.empty())
+  {
+    std::cerr<<"WARNING: nothing to tune instancing with \n";
+    TuningSample sample = {_species.m_instancingProb, _species.m_maxInstancePerLevel, 0, 0, 0.0f, 0.0f};
+    return sample;
+  }
+
+  //the samples are independent, so they're made on separate threads, each making its hero trees on one thread
+  std::atomic<size_t> nextSample(0);
+  auto measureSamples = [&]()
+  {
+    for(size_t s=nextSample++; s<samples.size(); s=nextSample++)
+    {
+      TuningSample &sample = samples[s];
+      LSystem treeType = _species;
+      treeType.m_instancingProb = sample.m_instancingProb;
+      treeType.m_maxInstancePerLevel = sample.m_maxInstancePerLevel;
+      treeType.m_useSeed = true;
+      treeType.m_numThreads = 1;
+      treeType.m_instanceCacheDirectory = "";
+
+      treeType.fillInstanceCache(_targets.m_numHeroTrees);
+
+      //built step by step rather than with the full constructor, which would scatter and build the forest an extra
+      //time before the seed is set. Every sample gets the same trees in the same places
+      Forest forest;
+      forest.m_treeTypes.push_back(std::move(treeType));
+      forest.m_width = _targets.m_width;
+      forest.m_length = _targets.m_length;
+      forest.m_numTrees = _targets.m_numTrees;
+      forest.m_numHeroTrees = _targets.m_numHeroTrees;
+      forest.m_useSeed = true;
+      forest.m_seed = _species.m_seed;
+      forest.scatterForest();
+      forest.createForest();
+
+      size_t drawCalls = 0;
+      forest.m_outputCache[0].forEachElement([&](std::vector<ngl::Mat4> &_transforms, size_t, size_t, size_t)
+      {
+        drawCalls += _transforms.empty() ? 0 : 1;
+      });
+      sample.m_drawCalls = drawCalls;
+      sample.m_bytes = heroGeometryBytes(forest.m_treeTypes[0]) + forest.m_output.size()*sizeof(ngl::Mat4) +
+                       bytesOf(forest.m_leafOutput[0]);
+      sample.m_instancesPerTree = float(forest.m_output.size())/float(std::max(_targets.m_numTrees, size_t(1)));
+      if(_targets.m_maxBytes > 0)
+      {
+        sample.m_overBudget += std::max(0.0f, float(sample.m_bytes)/float(_targets.m_maxBytes)-1.0f);
+      }
+      if(_targets.m_maxDrawCalls > 0)
+      {
+        sample.m_overBudget += std::max(0.0f, float(sample.m_drawCalls)/float(_targets.m_maxDrawCalls)-1.0f);
+      }
+    }
+  };
+
+  size_t numThreads = std::min(size_t(std::max(1u, std::thread::hardware_concurrency())), samples.size());
+  std::vector<std::thread> threads = {};
+  for(size_t t=1; t<numThreads; t++)
+  {
+    threads.push_back(std::thread(measureSamples));
+  }
+  measureSamples();
+  for(auto &thread : threads)
+  {
+    thread.join();
+  }
+
+  //how far the instances per tree are from the target, as a ratio so being twice or half as many counts the same
+  auto targetError = [&](const TuningSample &_sample)
+  {
+    if(_targets.m_instancesPerTree <= 0.0f)
+    {
+      return 0.0f;
+    }
+    return std::fabs(std::log(std::max(_sample.m_instancesPerTree, 1e-3f)/_targets.m_instancesPerTree));
+  };
+  auto isBetter = [&](const TuningSample &_a, const TuningSample &_b)
+  {
+    if(_a.m_overBudget != _b.m_overBudget)
+    {
+      return _a.m_overBudget < _b.m_overBudget;
+    }
+    if(targetError(_a) != targetError(_b))
+    {
+      return targetError(_a) < targetError(_b);
+    }
+    return _a.m_drawCalls > _b.m_drawCalls;
+  };
+  TuningSample best = samples[0];
+  for(auto &sample : samples)
+  {
+    if(isBetter(sample, best))
+    {
+      best = sample;
+    }
+  }
+  if(best.m_overBudget > 0.0f)
+  {
+    std::cerr<<"WARNING: no instancing settings tried fit the tuning targets, using the closest \n";
+  }
+
+  _species.m_instancingProb = best.m_instancingProb;
+  _species.m_maxInstancePerLevel = best.m_maxInstancePerLevel;
+  if(_samples != nullptr)
+  {
+    *_samples = std::move(samples);
+  }
+  return best;
+}
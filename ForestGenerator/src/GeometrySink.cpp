@@ -0,0 +1,137 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file GeometrySink.cpp
+/// @brief implementation file for GeometrySink classes
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include "GeometrySink.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+///BUFFER SINK
+//----------------------------------------------------------------------------------------------------------------------
+
+BufferSink::BufferSink(std::vector<ngl::Vec3> &_vertices, std::vector<GLuint> &_indices, std::vector<float> &_widths) :
+  m_vertices(_vertices), m_indices(_indices), m_widths(_widths) {}
+
+GLuint BufferSink::addVertex(const ngl::Vec3 &_vertex, float _width)
+{
+  m_vertices.push_back(_vertex);
+  m_widths.push_back(_width);
+  return GLuint(m_vertices.size()-1);
+}
+
+void BufferSink::addSegment(GLuint _start, GLuint _end)
+{
+  m_indices.push_back(_start);
+  m_indices.push_back(_end);
+}
+
+size_t BufferSink::numIndices() const
+{
+  return m_indices.size();
+}
+
+void BufferSink::reserve(size_t _numVertices, size_t _numIndices)
+{
+  m_vertices.reserve(m_vertices.size()+_numVertices);
+  m_widths.reserve(m_widths.size()+_numVertices);
+  m_indices.reserve(m_indices.size()+_numIndices);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+///ARRAY SINK
+//----------------------------------------------------------------------------------------------------------------------
+
+ArraySink::ArraySink(ngl::Vec3 * _vertices, size_t _maxVertices, GLuint * _indices, size_t _maxIndices) :
+  m_vertices(_vertices), m_maxVertices(_maxVertices), m_indices(_indices), m_maxIndices(_maxIndices) {}
+
+GLuint ArraySink::addVertex(const ngl::Vec3 &_vertex, float)
+{
+  if(m_numVertices<m_maxVertices)
+  {
+    m_vertices[m_numVertices] = _vertex;
+  }
+  else
+  {
+    m_overflow = true;
+  }
+  return GLuint(m_numVertices++);
+}
+
+void ArraySink::addSegment(GLuint _start, GLuint _end)
+{
+  if(m_numIndices+2<=m_maxIndices)
+  {
+    m_indices[m_numIndices] = _start;
+    m_indices[m_numIndices+1] = _end;
+  }
+  else
+  {
+    m_overflow = true;
+  }
+  m_numIndices += 2;
+}
+
+size_t ArraySink::numIndices() const
+{
+  return m_numIndices;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+///BOUNDS SINK
+//----------------------------------------------------------------------------------------------------------------------
+
+GLuint BoundsSink::addVertex(const ngl::Vec3 &_vertex, float _width)
+{
+  if(m_numVertices==0)
+  {
+    m_min = _vertex;
+    m_max = _vertex;
+  }
+  else
+  {
+    m_min.m_x = std::min(m_min.m_x, _vertex.m_x);
+    m_min.m_y = std::min(m_min.m_y, _vertex.m_y);
+    m_min.m_z = std::min(m_min.m_z, _vertex.m_z);
+    m_max.m_x = std::max(m_max.m_x, _vertex.m_x);
+    m_max.m_y = std::max(m_max.m_y, _vertex.m_y);
+    m_max.m_z = std::max(m_max.m_z, _vertex.m_z);
+  }
+  m_maxWidth = std::max(m_maxWidth, _width);
+  return GLuint(m_numVertices++);
+}
+
+void BoundsSink::addSegment(GLuint, GLuint)
+{
+  m_numSegments++;
+}
+
+size_t BoundsSink::numIndices() const
+{
+  return 2*m_numSegments;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+///OBJ SINK
+//----------------------------------------------------------------------------------------------------------------------
+
+OBJSink::OBJSink(std::ostream &_stream) :
+  m_stream(_stream) {}
+
+GLuint OBJSink::addVertex(const ngl::Vec3 &_vertex, float)
+{
+  m_stream<<"v "<<_vertex.m_x<<' '<<_vertex.m_y<<' '<<_vertex.m_z<<'\n';
+  return GLuint(m_numVertices++);
+}
+
+void OBJSink::addSegment(GLuint _start, GLuint _end)
+{
+  //OBJ indices start from 1
+  m_stream<<"l "<<_start+1<<' '<<_end+1<<'\n';
+  m_numIndices += 2;
+}
+
+size_t OBJSink::numIndices() const
+{
+  return m_numIndices;
+}
@@ -10,7 +10,7 @@ Grid::Grid(GLshort _numRows, float _spacing)
   float startVal = float(_numRows)*_spacing*0.5f;
   m_vertices = {};
   m_indices = {};
-  GLshort index = 0;
+  GLuint index = 0;
 
   //ROWS
   for(float a=-startVal; a<=startVal; a+=_spacing)
@@ -32,8 +32,8 @@ Grid::Grid(GLshort _numRows, float _spacing)
   {
     for(GLshort j=0; j<_numRows; j++)
     {
-      m_indices.push_back(i+j*(_numRows+1));
-      m_indices.push_back(i+(j+1)*(_numRows+1));
+      m_indices.push_back(GLuint(i+j*(_numRows+1)));
+      m_indices.push_back(GLuint(i+(j+1)*(_numRows+1)));
     }
   }
 }
@@ -6,7 +6,74 @@
 #include "Instance.h"
 
 Instance::Instance(ngl::Mat4 _transform) :
-  m_transform(_transform) {}
+  m_transform(_transform), m_inverseTransform(_transform.inverse()) {}
 
 Instance::ExitPoint::ExitPoint(size_t _exitId, size_t _exitAge, ngl::Mat4 _exitTransform) :
   m_exitId(_exitId), m_exitAge(_exitAge), m_exitTransform(_exitTransform) {}
+
+Instance::Leaf::Leaf(const ngl::Mat4 &_transform, float _size) :
+  m_position(_transform.m_30, _transform.m_31, _transform.m_32),
+  m_dir(_transform.m_10, _transform.m_11, _transform.m_12),
+  m_right(_transform.m_00, _transform.m_01, _transform.m_02),
+  m_size(_size) {}
+
+ngl::Mat4 Instance::Leaf::transform() const
+{
+  //same layout as Turtle::transform(), with the frame scaled by the leaf size
+  ngl::Vec3 right = m_size*m_right;
+  ngl::Vec3 dir = m_size*m_dir;
+  ngl::Vec3 k = right.cross(m_dir);
+  return ngl::Mat4(right.m_x,      right.m_y,      right.m_z,      0,
+                   dir.m_x,        dir.m_y,        dir.m_z,        0,
+                   k.m_x,          k.m_y,          k.m_z,          0,
+                   m_position.m_x, m_position.m_y, m_position.m_z, 1);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+ArenaRange<Instance::ExitPoint> InstanceArena::exitPoints(const Instance &_instance)
+{
+  return {m_exitPoints.data()+_instance.m_firstExitPoint, _instance.m_numExitPoints};
+}
+
+ArenaRange<const Instance::ExitPoint> InstanceArena::exitPoints(const Instance &_instance) const
+{
+  return {m_exitPoints.data()+_instance.m_firstExitPoint, _instance.m_numExitPoints};
+}
+
+ArenaRange<Instance::Leaf> InstanceArena::leaves(const Instance &_instance)
+{
+  return {m_leaves.data()+_instance.m_firstLeaf, _instance.m_numLeaves};
+}
+
+ArenaRange<const Instance::Leaf> InstanceArena::leaves(const Instance &_instance) const
+{
+  return {m_leaves.data()+_instance.m_firstLeaf, _instance.m_numLeaves};
+}
+
+void InstanceArena::append(Instance &_instance, const std::vector<Instance::ExitPoint> &_exitPoints,
+                           const std::vector<Instance::Leaf> &_leaves)
+{
+  _instance.m_firstExitPoint = m_exitPoints.size();
+  _instance.m_numExitPoints = _exitPoints.size();
+  m_exitPoints.insert(m_exitPoints.end(), _exitPoints.begin(), _exitPoints.end());
+  _instance.m_firstLeaf = m_leaves.size();
+  _instance.m_numLeaves = _leaves.size();
+  m_leaves.insert(m_leaves.end(), _leaves.begin(), _leaves.end());
+}
+
+void InstanceArena::append(Instance &_instance, const InstanceArena &_other)
+{
+  auto exitPoints = _other.exitPoints(_instance);
+  auto leaves = _other.leaves(_instance);
+  _instance.m_firstExitPoint = m_exitPoints.size();
+  m_exitPoints.insert(m_exitPoints.end(), exitPoints.begin(), exitPoints.end());
+  _instance.m_firstLeaf = m_leaves.size();
+  m_leaves.insert(m_leaves.end(), leaves.begin(), leaves.end());
+}
+
+void InstanceArena::clear()
+{
+  m_exitPoints.clear();
+  m_leaves.clear();
+}
@@ -9,6 +9,7 @@
 #include <chrono>
 #include <stdexcept>
 #include <iostream>
+#include <fstream>
 #include <math.h>
 #include <string>
 #include <boost/algorithm/string.hpp>
@@ -24,10 +25,7 @@ LSystem::LSystem(std::string _axiom, std::vector<std::string> _rules,
   m_axiom(_axiom), m_stepSize(_stepSize), m_stepScale(_stepScale),
   m_angle(_angle), m_angleScale(_angleScale), m_generation(_generation)
 {
-  for(size_t i=0; i<_rules.size() ; i++)
-  {
-    m_ruleArray.at(i)=_rules[i];
-  }
+  m_ruleArray = _rules;
   breakDownRules(_rules);
   createGeometry();
 }
@@ -72,6 +70,8 @@ void LSystem::seedRandomEngine()
 void LSystem::countBranches()
 {
   m_branches = {m_axiom};
+  //build the non-terminal regex once here rather than once per branch
+  std::regex nonTerminals(m_nonTerminals);
   for(auto &rule : m_rules)
   {
     rule.m_numBranches = {};
@@ -106,7 +106,7 @@ void LSystem::countBranches()
 
           std::string branch(rhs.begin()+int(i+1),rhs.begin()+int(j));
           //check that the branch contains at least one non-terminal
-          if(std::regex_search(branch, std::regex(m_nonTerminals)))
+          if(std::regex_search(branch, nonTerminals))
           {
             numBranches++;
             //if the branch hasn't been added to m_branches already, then add it
@@ -127,6 +127,7 @@ void LSystem::countBranches()
 void LSystem::breakDownRules(std::vector<std::string> _rules)
 {
   m_rules = {};
+  m_ruleIndices = {};
   m_nonTerminals = "[";
   for(auto ruleString : _rules)
   {
@@ -160,22 +161,19 @@ void LSystem::breakDownRules(std::vector<std::string> _rules)
       }
 
       //now if the LHS is already a LHS of some rule in m_rules, add the RHS and probabilities to that rule
-      size_t i=0;
-      for(; i<m_rules.size(); i++)
+      auto it = m_ruleIndices.find(LRP[0]);
+      if(it != m_ruleIndices.end())
       {
-        Rule &r = m_rules[i];
-        if(LRP[0]==r.m_LHS)
-        {
-          r.m_RHS.push_back(LRP[1]);
-          r.m_prob.push_back(probability);
-          break;
-        }
+        Rule &r = m_rules[it->second];
+        r.m_RHS.push_back(LRP[1]);
+        r.m_prob.push_back(probability);
       }
       //otherwise if the LHS hasn't been seen before, create a new rule and add it to m_rules
       //and also add this new LHS to m_nonTerminals
-      if(i==m_rules.size())
+      else
       {
         Rule r(LRP[0],{LRP[1]},{probability});
+        m_ruleIndices[LRP[0]] = m_rules.size();
         m_rules.push_back(r);
         m_nonTerminals += LRP[0];
       }
@@ -198,21 +196,63 @@ void LSystem::breakDownRules(std::vector<std::string> _rules)
 
 //----------------------------------------------------------------------------------------------------------------------
 
+void LSystem::setRule(size_t _index, std::string _rule)
+{
+  if(_index>=m_ruleArray.size())
+  {
+    m_ruleArray.resize(_index+1,"");
+  }
+  m_ruleArray[_index] = _rule;
+}
+
+bool LSystem::loadRules(const std::string &_fileName)
+{
+  std::ifstream ruleFile(_fileName);
+  if(!ruleFile.is_open())
+  {
+    std::cerr<<"WARNING: unable to open rule file "<<_fileName<<'\n';
+    return false;
+  }
+  std::vector<std::string> rules = {};
+  std::string line;
+  while(std::getline(ruleFile, line))
+  {
+    boost::trim(line);
+    if(line.empty() || line[0]=='#')
+    {
+      continue;
+    }
+    rules.push_back(line);
+  }
+  m_ruleArray = rules;
+  breakDownRules(rules);
+  return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
 std::string LSystem::generateTreeString()
 {
-  std::string treeString = m_axiom;
+  return deriveString(m_axiom, 0, m_gen);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+std::string LSystem::deriveString(std::string _string, int _firstGeneration, std::default_random_engine &_gen) const
+{
+  std::string treeString = std::move(_string);
   int numRules = int(m_rules.size());
 
   std::uniform_real_distribution<float> dist(0.0,1.0);
 
   if(numRules>0)
   {
-    for(int i=0; i<m_generation; i++)
+    for(int i=_firstGeneration; i<m_generation; i++)
     {
       size_t ruleNum = size_t(i % numRules);
-      std::string lhs = m_rules[ruleNum].m_LHS;
-      std::vector<std::string> RHS = m_rules[ruleNum].m_RHS;
-      std::vector<float> probabilities = m_rules[ruleNum].m_prob;
+      const std::string &lhs = m_rules[ruleNum].m_LHS;
+      const std::vector<std::string> &RHS = m_rules[ruleNum].m_RHS;
+      const std::vector<float> &probabilities = m_rules[ruleNum].m_prob;
 
       //use boost method if there is only one rhs - much faster
       if(RHS.size()==1)
@@ -229,7 +269,7 @@ std::string LSystem::generateTreeString()
         size_t len = lhs.size();
         while(pos != std::string::npos)
         {
-          float randNum = dist(m_gen);
+          float randNum = dist(_gen);
           float count = 0;
           size_t j = 0;
           for( ; j<probabilities.size(); j++)
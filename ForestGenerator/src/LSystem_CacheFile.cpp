@@ -0,0 +1,562 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file LSystem_CacheFile.cpp
+/// @brief implementation file for LSystem class methods that save and load a filled instance cache, so a tree type
+/// only has to be generated once
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iterator>
+#include <iostream>
+#include <thread>
+#include <functional>
+#include <ngl/Vec3.h>
+#include <ngl/Mat4.h>
+#include "LSystem.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#include <process.h>
+#endif
+
+//----------------------------------------------------------------------------------------------------------------------
+//the file is a header followed by sections of fixed size records, each starting on an 8 byte boundary. Everything is
+//stored in the byte order of the machine that wrote it, so the arrays can be used straight from the mapped file, and
+//a file from a machine with a different byte order (or an older version of the format) is just regenerated
+//----------------------------------------------------------------------------------------------------------------------
+
+static_assert(sizeof(ngl::Vec3) == 3*sizeof(float), "cache files store ngl::Vec3 as 3 floats");
+static_assert(sizeof(ngl::Mat4) == 16*sizeof(float), "cache files store ngl::Mat4 as 16 floats");
+
+enum CacheFileSection
+{
+  SLOT_KEYS,
+  SLOT_OFFSETS,
+  INSTANCES,
+  EXIT_POINTS,
+  LEAVES,
+  HERO_VERTICES,
+  HERO_INDICES,
+  HERO_WIDTHS,
+  HERO_TUBE_VERTICES,
+  HERO_TUBE_INDICES,
+  HERO_STRIP_INDICES,
+  HERO_QUANTISED_VERTICES,
+  NUM_SECTIONS
+};
+
+struct CacheFileHeader
+{
+  char m_magic[8];
+  uint32_t m_version;
+  uint32_t m_byteOrder;
+  uint64_t m_key;
+  uint64_t m_numIds;
+  uint64_t m_numAges;
+  float m_bounds[6];
+  float m_quantiseCentre[3];
+  float m_quantiseScale[3];
+  //offset in bytes from the start of the file and number of records for each section
+  uint64_t m_sectionOffsets[NUM_SECTIONS];
+  uint64_t m_sectionCounts[NUM_SECTIONS];
+};
+
+struct InstanceRecord
+{
+  float m_transform[16];
+  float m_boundsMin[3];
+  float m_boundsMax[3];
+  uint64_t m_instanceStart;
+  uint64_t m_instanceEnd;
+  uint64_t m_stripStart;
+  uint64_t m_stripEnd;
+  uint64_t m_weight;
+  //each instance's exit points and leaves are a range of the EXIT_POINTS and LEAVES sections
+  uint64_t m_firstExitPoint;
+  uint64_t m_numExitPoints;
+  uint64_t m_firstLeaf;
+  uint64_t m_numLeaves;
+};
+
+struct ExitPointRecord
+{
+  uint64_t m_exitId;
+  uint64_t m_exitAge;
+  float m_transform[16];
+};
+
+struct LeafRecord
+{
+  float m_position[3];
+  float m_dir[3];
+  float m_right[3];
+  float m_size;
+};
+
+static const char CACHE_FILE_MAGIC[8] = {'F','G','C','A','C','H','E','\0'};
+//bump this whenever the layout above or the way fillInstanceCache generates trees changes
+static const uint32_t CACHE_FILE_VERSION = 3;
+static const uint32_t CACHE_FILE_BYTE_ORDER = 0x01020304;
+
+static void writeVec3(float *_out, const ngl::Vec3 &_vector)
+{
+  _out[0] = _vector.m_x;
+  _out[1] = _vector.m_y;
+  _out[2] = _vector.m_z;
+}
+
+static ngl::Vec3 readVec3(const float *_in)
+{
+  return ngl::Vec3(_in[0], _in[1], _in[2]);
+}
+
+static size_t alignSection(size_t _offset)
+{
+  return (_offset+7) & ~size_t(7);
+}
+
+static long processId()
+{
+#ifndef _WIN32
+  return long(getpid());
+#else
+  return long(_getpid());
+#endif
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//a read only view of a whole file, memory mapped where possible
+//----------------------------------------------------------------------------------------------------------------------
+
+class MappedFile
+{
+public:
+  MappedFile(const std::string &_fileName)
+  {
+#ifndef _WIN32
+    int fd = open(_fileName.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+      return;
+    }
+    struct stat fileStat;
+    if(fstat(fd, &fileStat) == 0 && fileStat.st_size > 0)
+    {
+      void *map = mmap(nullptr, size_t(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+      if(map != MAP_FAILED)
+      {
+        m_data = static_cast<const char *>(map);
+        m_size = size_t(fileStat.st_size);
+      }
+    }
+    close(fd);
+#else
+    std::ifstream file(_fileName, std::ios::binary);
+    if(file.is_open())
+    {
+      m_buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+      m_data = m_buffer.data();
+      m_size = m_buffer.size();
+    }
+#endif
+  }
+
+  ~MappedFile()
+  {
+#ifndef _WIN32
+    if(m_data != nullptr)
+    {
+      munmap(const_cast<char *>(m_data), m_size);
+    }
+#endif
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const char *m_data = nullptr;
+  size_t m_size = 0;
+
+#ifdef _WIN32
+private:
+  std::vector<char> m_buffer;
+#endif
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+//FNV-1a, which is stable between runs and machines unlike std::hash
+class CacheKeyHasher
+{
+public:
+  void add(const void *_data, size_t _size)
+  {
+    const unsigned char *bytes = static_cast<const unsigned char *>(_data);
+    for(size_t i=0; i<_size; i++)
+    {
+      m_hash ^= bytes[i];
+      m_hash *= 1099511628211ULL;
+    }
+  }
+  template<class T>
+  void add(const T &_value) { add(&_value, sizeof(T)); }
+  void add(const std::string &_string)
+  {
+    add(uint64_t(_string.size()));
+    add(_string.data(), _string.size());
+  }
+
+  uint64_t m_hash = 14695981039346656037ULL;
+};
+
+uint64_t LSystem::instanceCacheKey(int _numHeroTrees) const
+{
+  CacheKeyHasher hasher;
+  hasher.add(CACHE_FILE_VERSION);
+  hasher.add(m_axiom);
+  hasher.add(uint64_t(m_rules.size()));
+  for(auto &rule : m_rules)
+  {
+    hasher.add(rule.m_LHS);
+    hasher.add(uint64_t(rule.m_RHS.size()));
+    for(size_t i=0; i<rule.m_RHS.size(); i++)
+    {
+      hasher.add(rule.m_RHS[i]);
+      hasher.add(rule.m_prob[i]);
+    }
+  }
+  hasher.add(m_stepSize);
+  hasher.add(m_stepScale);
+  hasher.add(m_angle);
+  hasher.add(m_angleScale);
+  hasher.add(m_width);
+  hasher.add(m_widthScale);
+  hasher.add(m_leafSize);
+  hasher.add(int32_t(m_generation));
+  hasher.add(uint64_t(m_seed));
+  hasher.add(m_instancingProb);
+  hasher.add(uint64_t(m_maxInstancePerLevel));
+  hasher.add(uint8_t(m_deduplicateInstances));
+  hasher.add(m_deduplicateTolerance);
+  hasher.add(uint8_t(m_fillMissingInstances));
+  hasher.add(uint64_t(m_instanceIndexBudget));
+  hasher.add(uint64_t(m_instanceVariantBudget));
+  hasher.add(uint8_t(m_tubeMode));
+  hasher.add(uint64_t(m_tubeSides));
+  hasher.add(uint8_t(m_stripMode));
+  hasher.add(uint8_t(m_simplify));
+  hasher.add(m_simplifyAngle);
+  hasher.add(uint8_t(m_quantiseHeroVertices));
+  hasher.add(int32_t(_numHeroTrees));
+  return hasher.m_hash;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+std::string LSystem::instanceCacheFileName(int _numHeroTrees) const
+{
+  //without a seed the trees are different every time, so there's nothing worth keeping
+  if(m_instanceCacheDirectory.empty() || m_useSeed == false)
+  {
+    return "";
+  }
+  std::ostringstream fileName;
+  fileName<<m_instanceCacheDirectory<<"/"<<std::hex<<std::setw(16)<<std::setfill('0')
+          <<instanceCacheKey(_numHeroTrees)<<".fgcache";
+  return fileName.str();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+bool LSystem::saveInstanceCache(const std::string &_fileName, uint64_t _key)
+{
+  std::vector<uint64_t> slotKeys(m_instanceCache.m_slotKeys.begin(), m_instanceCache.m_slotKeys.end());
+  std::vector<uint64_t> slotOffsets(m_instanceCache.m_offsets.begin(), m_instanceCache.m_offsets.end());
+  std::vector<InstanceRecord> instances = {};
+  std::vector<ExitPointRecord> exitPoints = {};
+  std::vector<LeafRecord> leaves = {};
+  instances.reserve(m_instanceCache.numElements());
+  m_instanceCache.forEachElement([&](Instance &_instance, size_t, size_t, size_t)
+  {
+    InstanceRecord record;
+    std::memcpy(record.m_transform, &_instance.m_transform.m_m[0][0], sizeof(record.m_transform));
+    writeVec3(record.m_boundsMin, _instance.m_bounds.m_min);
+    writeVec3(record.m_boundsMax, _instance.m_bounds.m_max);
+    record.m_instanceStart = _instance.m_instanceStart;
+    record.m_instanceEnd = _instance.m_instanceEnd;
+    record.m_stripStart = _instance.m_stripStart;
+    record.m_stripEnd = _instance.m_stripEnd;
+    record.m_weight = _instance.m_weight;
+    record.m_firstExitPoint = exitPoints.size();
+    record.m_numExitPoints = _instance.m_numExitPoints;
+    record.m_firstLeaf = leaves.size();
+    record.m_numLeaves = _instance.m_numLeaves;
+    instances.push_back(record);
+
+    for(auto &exitPoint : m_instanceArena.exitPoints(_instance))
+    {
+      ExitPointRecord exitRecord;
+      exitRecord.m_exitId = exitPoint.m_exitId;
+      exitRecord.m_exitAge = exitPoint.m_exitAge;
+      std::memcpy(exitRecord.m_transform, &exitPoint.m_exitTransform.m_m[0][0], sizeof(exitRecord.m_transform));
+      exitPoints.push_back(exitRecord);
+    }
+    for(auto &leaf : m_instanceArena.leaves(_instance))
+    {
+      LeafRecord leafRecord;
+      writeVec3(leafRecord.m_position, leaf.m_position);
+      writeVec3(leafRecord.m_dir, leaf.m_dir);
+      writeVec3(leafRecord.m_right, leaf.m_right);
+      leafRecord.m_size = leaf.m_size;
+      leaves.push_back(leafRecord);
+    }
+  });
+
+  const void *sectionData[NUM_SECTIONS] = {slotKeys.data(), slotOffsets.data(), instances.data(), exitPoints.data(),
+                                           leaves.data(), m_heroVertices.data(), m_heroIndices.data(), m_heroWidths.data(),
+                                           m_heroTubeVertices.data(), m_heroTubeIndices.data(),
+                                           m_heroStripIndices.data(), m_heroQuantisedVertices.data()};
+  size_t sectionCounts[NUM_SECTIONS] = {slotKeys.size(), slotOffsets.size(), instances.size(), exitPoints.size(),
+                                        leaves.size(), m_heroVertices.size(), m_heroIndices.size(), m_heroWidths.size(),
+                                        m_heroTubeVertices.size(), m_heroTubeIndices.size(),
+                                        m_heroStripIndices.size(), m_heroQuantisedVertices.size()};
+  size_t recordSizes[NUM_SECTIONS] = {sizeof(uint64_t), sizeof(uint64_t), sizeof(InstanceRecord),
+                                      sizeof(ExitPointRecord), sizeof(LeafRecord), sizeof(ngl::Vec3), sizeof(GLuint),
+                                      sizeof(float), sizeof(ngl::Vec3), sizeof(GLuint), sizeof(GLuint), sizeof(GLshort)};
+
+  CacheFileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.m_magic, CACHE_FILE_MAGIC, sizeof(header.m_magic));
+  header.m_version = CACHE_FILE_VERSION;
+  header.m_byteOrder = CACHE_FILE_BYTE_ORDER;
+  header.m_key = _key;
+  header.m_numIds = m_instanceCache.numIds();
+  header.m_numAges = m_instanceCache.numAges();
+  writeVec3(header.m_bounds, m_bounds.m_min);
+  writeVec3(header.m_bounds+3, m_bounds.m_max);
+  writeVec3(header.m_quantiseCentre, m_heroQuantiseCentre);
+  writeVec3(header.m_quantiseScale, m_heroQuantiseScale);
+  size_t offset = alignSection(sizeof(CacheFileHeader));
+  for(size_t s=0; s<NUM_SECTIONS; s++)
+  {
+    header.m_sectionOffsets[s] = offset;
+    header.m_sectionCounts[s] = sectionCounts[s];
+    offset = alignSection(offset+sectionCounts[s]*recordSizes[s]);
+  }
+
+  //write to a temporary file and move it into place, so anything loading the same file at the same time never
+  //sees it half written. The name has the process and thread as well as the time in it, since render nodes sharing
+  //a cache directory can save the same tree at the same moment
+  std::ostringstream tmpName;
+  tmpName<<_fileName<<".tmp"<<processId()<<"_"<<std::hash<std::thread::id>()(std::this_thread::get_id())<<"_"
+         <<std::chrono::steady_clock::now().time_since_epoch().count();
+  std::string tmpFileName = tmpName.str();
+  std::ofstream file(tmpFileName, std::ios::binary);
+  if(file.is_open() == false)
+  {
+    std::cerr<<"WARNING: unable to write instance cache file "<<_fileName<<'\n';
+    return false;
+  }
+  const char padding[8] = {0,0,0,0,0,0,0,0};
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  size_t written = sizeof(header);
+  for(size_t s=0; s<NUM_SECTIONS; s++)
+  {
+    file.write(padding, std::streamsize(header.m_sectionOffsets[s]-written));
+    file.write(static_cast<const char *>(sectionData[s]), std::streamsize(sectionCounts[s]*recordSizes[s]));
+    written = header.m_sectionOffsets[s]+sectionCounts[s]*recordSizes[s];
+  }
+  file.close();
+  if(file.fail() || std::rename(tmpFileName.c_str(), _fileName.c_str()) != 0)
+  {
+    std::remove(tmpFileName.c_str());
+    std::cerr<<"WARNING: unable to write instance cache file "<<_fileName<<'\n';
+    return false;
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+bool LSystem::loadInstanceCache(const std::string &_fileName, uint64_t _key)
+{
+  MappedFile file(_fileName);
+  if(file.m_data == nullptr)
+  {
+    return false;
+  }
+
+  CacheFileHeader header;
+  if(file.m_size < sizeof(header))
+  {
+    std::cerr<<"WARNING: instance cache file "<<_fileName<<" is too short, regenerating it \n";
+    return false;
+  }
+  std::memcpy(&header, file.m_data, sizeof(header));
+  if(std::memcmp(header.m_magic, CACHE_FILE_MAGIC, sizeof(header.m_magic)) != 0 ||
+     header.m_version != CACHE_FILE_VERSION || header.m_byteOrder != CACHE_FILE_BYTE_ORDER ||
+     header.m_key != _key || header.m_numIds != m_instanceCache.numIds() ||
+     header.m_numAges != m_instanceCache.numAges())
+  {
+    std::cerr<<"WARNING: instance cache file "<<_fileName<<" doesn't match this tree, regenerating it \n";
+    return false;
+  }
+
+  size_t recordSizes[NUM_SECTIONS] = {sizeof(uint64_t), sizeof(uint64_t), sizeof(InstanceRecord),
+                                      sizeof(ExitPointRecord), sizeof(LeafRecord), sizeof(ngl::Vec3), sizeof(GLuint),
+                                      sizeof(float), sizeof(ngl::Vec3), sizeof(GLuint), sizeof(GLuint), sizeof(GLshort)};
+  for(size_t s=0; s<NUM_SECTIONS; s++)
+  {
+    if(header.m_sectionOffsets[s] % 8 != 0 || header.m_sectionOffsets[s] > file.m_size ||
+       header.m_sectionCounts[s] > (file.m_size-header.m_sectionOffsets[s])/recordSizes[s])
+    {
+      std::cerr<<"WARNING: instance cache file "<<_fileName<<" is corrupt, regenerating it \n";
+      return false;
+    }
+  }
+
+  //the sections are aligned in the file and the mapping is page aligned, so they can be read in place
+  auto section = [&](CacheFileSection _section) { return file.m_data+header.m_sectionOffsets[_section]; };
+  auto count = [&](CacheFileSection _section) { return size_t(header.m_sectionCounts[_section]); };
+
+  const uint64_t *slotKeys = reinterpret_cast<const uint64_t *>(section(SLOT_KEYS));
+  const uint64_t *slotOffsets = reinterpret_cast<const uint64_t *>(section(SLOT_OFFSETS));
+  const InstanceRecord *instances = reinterpret_cast<const InstanceRecord *>(section(INSTANCES));
+  const ExitPointRecord *exitPoints = reinterpret_cast<const ExitPointRecord *>(section(EXIT_POINTS));
+  const LeafRecord *leaves = reinterpret_cast<const LeafRecord *>(section(LEAVES));
+
+  //check every range before touching the cache, so a bad file leaves the tree as it was
+  //only filled slots are stored, so keys and offsets both strictly increase
+  uint64_t numKeys = header.m_numIds*header.m_numAges;
+  bool valid = count(SLOT_OFFSETS) == count(SLOT_KEYS)+1 && slotOffsets[0] == 0 &&
+               slotOffsets[count(SLOT_OFFSETS)-1] == count(INSTANCES);
+  for(size_t i=0; valid && i<count(SLOT_KEYS); i++)
+  {
+    valid = slotKeys[i] < numKeys && (i == 0 || slotKeys[i-1] < slotKeys[i]) && slotOffsets[i] < slotOffsets[i+1];
+  }
+  for(size_t i=0; valid && i<count(INSTANCES); i++)
+  {
+    valid = instances[i].m_firstExitPoint <= count(EXIT_POINTS) &&
+            instances[i].m_numExitPoints <= count(EXIT_POINTS)-instances[i].m_firstExitPoint &&
+            instances[i].m_firstLeaf <= count(LEAVES) &&
+            instances[i].m_numLeaves <= count(LEAVES)-instances[i].m_firstLeaf &&
+            instances[i].m_instanceStart <= instances[i].m_instanceEnd &&
+            instances[i].m_instanceEnd <= count(HERO_INDICES) &&
+            instances[i].m_stripStart <= instances[i].m_stripEnd &&
+            instances[i].m_stripEnd <= count(HERO_STRIP_INDICES) &&
+            instances[i].m_weight > 0;
+  }
+  for(size_t e=0; valid && e<count(EXIT_POINTS); e++)
+  {
+    valid = exitPoints[e].m_exitId < header.m_numIds && exitPoints[e].m_exitAge < header.m_numAges;
+  }
+
+  //every index has to be a vertex of its buffer. Quantised vertices replace the full precision ones, 3 shorts each
+  size_t numHeroVertices = count(HERO_VERTICES);
+  if(count(HERO_QUANTISED_VERTICES) > 0)
+  {
+    valid = valid && numHeroVertices == 0 && count(HERO_QUANTISED_VERTICES) % 3 == 0;
+    numHeroVertices = count(HERO_QUANTISED_VERTICES)/3;
+  }
+  auto indicesValid = [](const char *_indices, size_t _numIndices, size_t _numVertices, bool _allowRestart)
+  {
+    const GLuint *indices = reinterpret_cast<const GLuint *>(_indices);
+    for(size_t i=0; i<_numIndices; i++)
+    {
+      if(indices[i] >= _numVertices && (_allowRestart == false || indices[i] != RESTART_INDEX))
+      {
+        return false;
+      }
+    }
+    return true;
+  };
+  valid = valid && indicesValid(section(HERO_INDICES), count(HERO_INDICES), numHeroVertices, false) &&
+          indicesValid(section(HERO_STRIP_INDICES), count(HERO_STRIP_INDICES), numHeroVertices, true) &&
+          indicesValid(section(HERO_TUBE_INDICES), count(HERO_TUBE_INDICES), count(HERO_TUBE_VERTICES), false);
+  //instance ranges carry straight over to the tube mesh, so it has to cover all the line indices
+  if(count(HERO_TUBE_INDICES) > 0)
+  {
+    valid = valid && count(HERO_TUBE_INDICES) == tubeIndex(count(HERO_INDICES));
+  }
+  if(valid == false)
+  {
+    std::cerr<<"WARNING: instance cache file "<<_fileName<<" is corrupt, regenerating it \n";
+    return false;
+  }
+
+  m_instanceCache.m_slotKeys.assign(slotKeys, slotKeys+count(SLOT_KEYS));
+  m_instanceCache.m_offsets.assign(slotOffsets, slotOffsets+count(SLOT_OFFSETS));
+  m_instanceCache.indexSlots();
+  m_instanceCache.m_elements.resize(count(INSTANCES));
+  for(size_t i=0; i<count(INSTANCES); i++)
+  {
+    const InstanceRecord &record = instances[i];
+    Instance &instance = m_instanceCache.m_elements[i];
+    std::memcpy(&instance.m_transform.m_m[0][0], record.m_transform, sizeof(record.m_transform));
+    instance.m_inverseTransform = instance.m_transform.inverse();
+    instance.m_bounds.m_min = readVec3(record.m_boundsMin);
+    instance.m_bounds.m_max = readVec3(record.m_boundsMax);
+    instance.m_instanceStart = size_t(record.m_instanceStart);
+    instance.m_instanceEnd = size_t(record.m_instanceEnd);
+    instance.m_stripStart = size_t(record.m_stripStart);
+    instance.m_stripEnd = size_t(record.m_stripEnd);
+    instance.m_weight = size_t(record.m_weight);
+    instance.m_firstExitPoint = size_t(record.m_firstExitPoint);
+    instance.m_numExitPoints = size_t(record.m_numExitPoints);
+    instance.m_firstLeaf = size_t(record.m_firstLeaf);
+    instance.m_numLeaves = size_t(record.m_numLeaves);
+  }
+
+  //the arena is laid out the same way as the file, so the ranges carry straight over
+  m_instanceArena = InstanceArena();
+  m_instanceArena.m_exitPoints.reserve(count(EXIT_POINTS));
+  for(size_t e=0; e<count(EXIT_POINTS); e++)
+  {
+    const ExitPointRecord &exitRecord = exitPoints[e];
+    ngl::Mat4 exitTransform;
+    std::memcpy(&exitTransform.m_m[0][0], exitRecord.m_transform, sizeof(exitRecord.m_transform));
+    m_instanceArena.m_exitPoints.push_back(Instance::ExitPoint(size_t(exitRecord.m_exitId),
+                                                               size_t(exitRecord.m_exitAge), exitTransform));
+  }
+  m_instanceArena.m_leaves.reserve(count(LEAVES));
+  for(size_t l=0; l<count(LEAVES); l++)
+  {
+    const LeafRecord &leafRecord = leaves[l];
+    ngl::Mat4 leafTransform(leafRecord.m_right[0],    leafRecord.m_right[1],    leafRecord.m_right[2],    0,
+                            leafRecord.m_dir[0],      leafRecord.m_dir[1],      leafRecord.m_dir[2],      0,
+                            0,                        0,                        0,                        0,
+                            leafRecord.m_position[0], leafRecord.m_position[1], leafRecord.m_position[2], 1);
+    m_instanceArena.m_leaves.push_back(Instance::Leaf(leafTransform, leafRecord.m_size));
+  }
+
+  //the geometry is copied straight out of the mapping in one go
+  const ngl::Vec3 *heroVertices = reinterpret_cast<const ngl::Vec3 *>(section(HERO_VERTICES));
+  const GLuint *heroIndices = reinterpret_cast<const GLuint *>(section(HERO_INDICES));
+  const float *heroWidths = reinterpret_cast<const float *>(section(HERO_WIDTHS));
+  const ngl::Vec3 *heroTubeVertices = reinterpret_cast<const ngl::Vec3 *>(section(HERO_TUBE_VERTICES));
+  const GLuint *heroTubeIndices = reinterpret_cast<const GLuint *>(section(HERO_TUBE_INDICES));
+  const GLuint *heroStripIndices = reinterpret_cast<const GLuint *>(section(HERO_STRIP_INDICES));
+  const GLshort *heroQuantisedVertices = reinterpret_cast<const GLshort *>(section(HERO_QUANTISED_VERTICES));
+  m_heroVertices.assign(heroVertices, heroVertices+count(HERO_VERTICES));
+  m_heroIndices.assign(heroIndices, heroIndices+count(HERO_INDICES));
+  m_heroWidths.assign(heroWidths, heroWidths+count(HERO_WIDTHS));
+  m_heroTubeVertices.assign(heroTubeVertices, heroTubeVertices+count(HERO_TUBE_VERTICES));
+  m_heroTubeIndices.assign(heroTubeIndices, heroTubeIndices+count(HERO_TUBE_INDICES));
+  m_heroStripIndices.assign(heroStripIndices, heroStripIndices+count(HERO_STRIP_INDICES));
+  m_heroQuantisedVertices.assign(heroQuantisedVertices, heroQuantisedVertices+count(HERO_QUANTISED_VERTICES));
+
+  m_bounds.m_min = readVec3(header.m_bounds);
+  m_bounds.m_max = readVec3(header.m_bounds+3);
+  m_heroQuantiseCentre = readVec3(header.m_quantiseCentre);
+  m_heroQuantiseScale = readVec3(header.m_quantiseScale);
+  return true;
+}
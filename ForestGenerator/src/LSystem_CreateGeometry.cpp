@@ -11,283 +11,588 @@
 #include <iostream>
 #include <math.h>
 #include <string>
+#include <thread>
+#include <atomic>
 #include <boost/algorithm/string.hpp>
-#include <ngl/Mat3.h>
 #include <ngl/Mat4.h>
 
 #include "LSystem.h"
+#include "Turtle.h"
+#include "GeometrySink.h"
 
 //----------------------------------------------------------------------------------------------------------------------
 
 void LSystem::createGeometry()
 {
-  std::string treeString = generateTreeString();
+  if(m_forestMode == false)
+  {
+    m_vertices = {};
+    m_indices = {};
+    m_widths = {};
+    BufferSink sink(m_vertices, m_indices, m_widths);
+    createGeometry(sink);
 
-  //std::cout<<treeString<<"\n\n";
+    if(m_simplify)
+    {
+      simplifyGeometry(m_vertices, m_indices, m_widths, {});
+    }
+    if(m_stripMode)
+    {
+      std::vector<size_t> stripBoundaries = {};
+      createLineStrips(m_indices, m_stripIndices, {}, stripBoundaries);
+    }
+    if(m_tubeMode)
+    {
+      createTubeMesh(m_vertices, m_widths, m_indices, m_tubeVertices, m_tubeIndices);
+    }
+  }
+  else
+  {
+    BufferSink sink(m_heroVertices, m_heroIndices, m_heroWidths);
+    createGeometry(sink);
+  }
+}
 
-  ngl::Vec3 dir(0,1,0);
-  ngl::Vec3 right(1,0,0);
-  //I am using an ngl::Mat4 matrix for now because there is a problem with the euler
-  //method for ngl::Mat3, so I am setting the rotation for r4 with r4.euler, then
-  //using the copy constructor to transfer that rotation to r3
-  ngl::Mat4 r4;
-  ngl::Mat3 r3;
-  ngl::Mat4 t4;
+//forwards everything to another sink, keeping the bounds of the vertices on the way through
+class BoundedSink : public GeometrySink
+{
+public:
+  BoundedSink(GeometrySink &_sink, BoundingBox &_bounds) : m_sink(_sink), m_bounds(_bounds) {}
 
-  ngl::Vec3 lastVertex(0,0,0);
-  GLshort lastIndex = 0;
-  float stepSize = m_stepSize;
-  float angle = m_angle;
+  GLuint addVertex(const ngl::Vec3 &_vertex, float _width) override
+  {
+    m_bounds.expand(_vertex);
+    return m_sink.addVertex(_vertex, _width);
+  }
+  void addSegment(GLuint _start, GLuint _end) override { m_sink.addSegment(_start, _end); }
+  size_t numIndices() const override { return m_sink.numIndices(); }
+  void reserve(size_t _numVertices, size_t _numIndices) override { m_sink.reserve(_numVertices, _numIndices); }
 
-  //paramVar will store the default value of each command, to be replaced by one
-  //parsed from brackets by parseBrackets() if necessary
-  float paramVar;
-  size_t id, age;
+  GeometrySink &m_sink;
+  BoundingBox &m_bounds;
+};
 
-  std::vector<GLshort> savedInd = {};
-  std::vector<ngl::Vec3> savedVert = {};
-  std::vector<ngl::Vec3> savedDir = {};
-  std::vector<ngl::Vec3> savedRight = {};
-  std::vector<float> savedStep = {};
-  std::vector<float> savedAngle = {};
+void LSystem::createGeometry(GeometrySink &_sink)
+{
+  std::string treeString = generateTreeString();
+  if(m_forestMode == false)
+  {
+    m_leaves = {};
+    m_bounds = BoundingBox();
+  }
+  BoundedSink sink(_sink, m_bounds);
 
-  Instance instance;
-  Instance * currentInstance;
-  std::vector<Instance *> savedInstance = {};
+  //std::cout<<treeString<<"\n\n";
 
-  std::vector<ngl::Vec3> * vertices;
-  std::vector<GLshort> * indices;
-  if(m_forestMode == false)
+  //outside of forest mode, large trees can have their top-level branches interpreted in parallel,
+  //otherwise (or if the tree isn't worth splitting) interpret the whole string in one go
+  if(m_forestMode || m_numThreads < 2 || createGeometryParallel(treeString, sink) == false)
   {
-    m_vertices = {lastVertex};
-    m_indices = {};
-    vertices = &m_vertices;
-    indices = &m_indices;
+    interpretTreeString(treeString, sink);
   }
-  else
+  if(m_forestMode == false)
   {
-    lastIndex = GLshort(m_heroVertices.size());
-    m_heroVertices.push_back(lastVertex);
-    vertices = &m_heroVertices;
-    indices = &m_heroIndices;
+    for(auto &leaf : m_leaves)
+    {
+      expandByLeaf(m_bounds, leaf);
+    }
   }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void LSystem::interpretTreeString(const std::string &_treeString, GeometrySink &_sink)
+{
+  Turtle turtle(m_stepSize, m_angle, m_width, 0);
+  //sin and cos of each angle are only calculated the first time that angle is used
+  RotationCache rotationCache;
+
+  size_t id, age;
+
+  //the whole turtle state is saved at each '[', in one contiguous stack
+  std::vector<Turtle> savedTurtles = {};
+  savedTurtles.reserve(64);
 
-  for(size_t i=0; i<treeString.size(); i++)
+  //instances are built up here while they're open, and written into the slot reserved for them in the cache when
+  //they close. Pushing to the cache can move its elements, so it's never written through a pointer held across commands
+  struct OpenInstance
   {
-    char c = treeString[i];
-    switch(c)
+    Instance m_instance;
+    bool m_isCached;
+    size_t m_id, m_age, m_innerIndex;
+  };
+  std::vector<OpenInstance> savedInstance = {};
+  //the exit points and leaves of the open instance at each depth, gathered here and copied into the arena in one go
+  //when it closes so each instance's are contiguous. The vectors are kept between instances to reuse their memory
+  std::vector<std::vector<Instance::ExitPoint>> openExitPoints = {};
+  std::vector<std::vector<Instance::Leaf>> openLeaves = {};
+
+  auto openInstance = [&](const ngl::Mat4 &_transform, bool _isCached)
+  {
+    OpenInstance open = {Instance(_transform), _isCached, id, age, 0};
+    open.m_instance.m_instanceStart = _sink.numIndices();
+    open.m_instance.m_bounds.expand(turtle.m_lastVertex);
+    if(_isCached)
     {
-      //move forward
-      case 'F':
-      {
-        indices->push_back(lastIndex);
-        paramVar = stepSize;
-        parseBrackets(treeString, i, paramVar);
-        lastVertex += paramVar*dir;
-        vertices->push_back(lastVertex);
-        lastIndex = GLshort(vertices->size()-1);
-        indices->push_back(lastIndex);
-        break;
-      }
+      m_instanceCache.pushBackElement(id, age, Instance());
+      open.m_innerIndex = m_instanceCache.numInstancesAt(id,age)-1;
+    }
+    savedInstance.push_back(std::move(open));
+    if(openExitPoints.size() < savedInstance.size())
+    {
+      openExitPoints.resize(savedInstance.size());
+      openLeaves.resize(savedInstance.size());
+    }
+    openExitPoints[savedInstance.size()-1].clear();
+    openLeaves[savedInstance.size()-1].clear();
+  };
 
-      //start branch
-      case '[':
-      {
-        savedInd.push_back(lastIndex);
-        savedVert.push_back(lastVertex);
-        savedDir.push_back(dir);
-        savedRight.push_back(right);
-        savedStep.push_back(stepSize);
-        savedAngle.push_back(angle);
-        break;
-      }
+  auto closeInstance = [&]()
+  {
+    OpenInstance &open = savedInstance.back();
+    size_t depth = savedInstance.size()-1;
+    open.m_instance.m_instanceEnd = _sink.numIndices();
+    if(savedInstance.size()>1)
+    {
+      //nested instance ranges are part of the outer range too
+      savedInstance[savedInstance.size()-2].m_instance.m_bounds.expand(open.m_instance.m_bounds);
+    }
+    if(open.m_isCached)
+    {
+      m_instanceArena.append(open.m_instance, openExitPoints[depth], openLeaves[depth]);
+      m_instanceCache.setElement(open.m_id, open.m_age, open.m_innerIndex, std::move(open.m_instance));
+    }
+    savedInstance.pop_back();
+  };
 
-      //end branch
-      case ']':
-      {
-        if(savedInd.size()>0)
-        {
-          lastIndex = savedInd.back();
-          lastVertex = savedVert.back();
-          dir = savedDir.back();
-          right = savedRight.back();
-          stepSize = savedStep.back();
-          angle = savedAngle.back();
-
-          savedInd.pop_back();
-          savedVert.pop_back();
-          savedDir.pop_back();
-          savedRight.pop_back();
-          savedStep.pop_back();
-          savedAngle.pop_back();
-        }
-        break;
-      }
+  turtle.m_lastIndex = _sink.addVertex(turtle.m_lastVertex, turtle.m_width);
 
-      //roll clockwise
-      case '/':
+  for(size_t i=0; i<_treeString.size(); i++)
+  {
+    char c = _treeString[i];
+    switch(c)
+    {
+      //startInstance
+      case '{':
       {
-        paramVar = angle;
-        parseBrackets(treeString, i, paramVar);
-        r4.euler(paramVar, dir.m_x, dir.m_y, dir.m_z);
-        r3 = r4;
-        right = r3*right;
+        parseInstanceBrackets(_treeString, i, id, age);
+        openInstance(turtle.transform(),
+                     m_instanceCache.numInstancesAt(id,age)<=size_t(m_maxInstancePerLevel/(age+1)));
         break;
       }
 
-      //roll anticlockwise
-      case '\\':
+      //stopInstance
+      case '}':
       {
-        paramVar = angle;
-        parseBrackets(treeString, i, paramVar);
-        r4.euler(-paramVar, dir.m_x, dir.m_y, dir.m_z);
-        r3 = r4;
-        right = r3*right;
+        closeInstance();
         break;
       }
 
-      //pitch up
-      case '&':
+      //getInstance
+      case '<':
       {
-        paramVar = angle;
-        parseBrackets(treeString, i, paramVar);
-        r4.euler(paramVar, right.m_x, right.m_y, right.m_z);
-        r3 = r4;
-        dir = r3*dir;
-        break;
-      }
+        parseInstanceBrackets(_treeString, i, id, age);
 
-      //pitch down
-      case '^':
-      {
-        paramVar = angle;
+        ngl::Mat4 transform = turtle.transform();
 
-        parseBrackets(treeString, i, paramVar);
-        r4.euler(-paramVar, right.m_x, right.m_y, right.m_z);
-        r3 = r4;
-        dir = r3*dir;
-        break;
-      }
+        for(size_t d=0; d<savedInstance.size(); d++)
+        {
+          const ngl::Mat4 &inverse = savedInstance[d].m_instance.m_inverseTransform;
+          openExitPoints[d].push_back(Instance::ExitPoint(id, age, inverse*transform));
+        }
+
+        bool filled = m_instanceCache.numInstancesAt(id,age) > 0;
+        size_t slot = id*m_instanceCache.numAges()+age;
+        if(filled == false && slot < m_earlierHeroSlots.size())
+        {
+          m_earlierHeroQueries.push_back(slot);
+          filled = m_earlierHeroSlots[slot];
+        }
+        if(filled == false)
+        {
+          openInstance(transform, true);
+        }
+        else
+        {
+          skipToNextChevron(_treeString,i);
+        }
 
-      //scale step size
-      case '\"':
-      {
-        paramVar = m_stepScale;
-        parseBrackets(treeString, i, paramVar);
-        stepSize *= paramVar;
         break;
       }
 
-      //scale angle
-      case ';':
+      case '>':
       {
-        paramVar = m_angleScale;
-        parseBrackets(treeString, i, paramVar);
-        angle *= paramVar;
+        //note that assuming > doesn't appear in any rules, we will only reach this case if we are using the corresponding < to make an instance
+        closeInstance();
         break;
       }
 
-      //startInstance
-      case '{':
+      //leaf
+      case '~':
       {
-        parseInstanceBrackets(treeString, i, id, age);
-
-        ngl::Vec3 k = right.cross(dir);
-        ngl::Mat4 transform(right.m_x,      right.m_y,      right.m_z,      0,
-                            dir.m_x,        dir.m_y,        dir.m_z,        0,
-                            k.m_x,          k.m_y,          k.m_z,          0,
-                            lastVertex.m_x, lastVertex.m_y, lastVertex.m_z, 1);
-
-        instance = Instance(transform);
-        instance.m_instanceStart = indices->size();//&(indices->back()); //except maybe should be &(indices->back())+1?
-        if(m_instanceCache.numInstancesAt(id,age)<=size_t(m_maxInstancePerLevel/(age+1)))
+        if(m_forestMode == false)
         {
-          m_instanceCache.pushBackElement(id, age, instance);
-          currentInstance = m_instanceCache.getLastElementAt(id,age);
+          m_leaves.push_back(createLeaf(_treeString, i, turtle, m_parameterError));
         }
         else
         {
-          currentInstance = &instance;
+          //like exit points, leaves are stored relative to every instance they're part of
+          Instance::Leaf leaf = createLeaf(_treeString, i, turtle, m_parameterError);
+          expandByLeaf(m_bounds, leaf);
+          if(savedInstance.empty() == false)
+          {
+            expandByLeaf(savedInstance.back().m_instance.m_bounds, leaf);
+          }
+          for(size_t d=0; d<savedInstance.size(); d++)
+          {
+            const ngl::Mat4 &inverse = savedInstance[d].m_instance.m_inverseTransform;
+            openLeaves[d].push_back(Instance::Leaf(inverse*turtle.transform(), leaf.m_size));
+          }
         }
-
-        savedInstance.push_back(currentInstance);
         break;
       }
 
-      //stopInstance
-      case '}':
+      //everything else just moves the turtle
+      default:
       {
-        currentInstance->m_instanceEnd = indices->size();
-        savedInstance.pop_back();
-        if(savedInstance.size()>0)
+        turtleCommand(_treeString, i, turtle, savedTurtles, rotationCache, _sink, m_parameterError);
+        //only F moves the turtle to a new position (']' goes back to one that's already been seen), so this
+        //keeps the innermost instance's bounds up to date, and they're passed out to the enclosing instances as they close
+        if(c == 'F' && savedInstance.empty() == false)
         {
-          currentInstance = savedInstance.back();
+          savedInstance.back().m_instance.m_bounds.expand(turtle.m_lastVertex);
         }
         break;
       }
+    }
+  }
+  //the instances are only moved into place once the whole tree is done
+  m_instanceCache.mergePushedElements();
+  if(m_parameterError)
+  {
+    std::cerr<<"WARNING: unable to parse one or more parameters \n";
+    m_parameterError = false;
+  }
+}
 
-      //getInstance
-      case '<':
+//----------------------------------------------------------------------------------------------------------------------
+
+void LSystem::turtleCommand(const std::string &_treeString, size_t &_i, Turtle &_turtle,
+                            std::vector<Turtle> &_savedTurtles, RotationCache &_rotationCache,
+                            GeometrySink &_sink, bool &_parameterError) const
+{
+  //paramVar will store the default value of each command, to be replaced by one
+  //parsed from brackets by parseBrackets() if necessary
+  float paramVar;
+  float sinAngle, cosAngle;
+
+  switch(_treeString[_i])
+  {
+    //move forward
+    case 'F':
+    {
+      paramVar = _turtle.m_stepSize;
+      parseBrackets(_treeString, _i, paramVar, _parameterError);
+      _turtle.m_lastVertex += paramVar*_turtle.m_dir;
+      GLuint newIndex = _sink.addVertex(_turtle.m_lastVertex, _turtle.m_width);
+      _sink.addSegment(_turtle.m_lastIndex, newIndex);
+      _turtle.m_lastIndex = newIndex;
+      break;
+    }
+
+    //start branch
+    case '[':
+    {
+      _savedTurtles.push_back(_turtle);
+      break;
+    }
+
+    //end branch
+    case ']':
+    {
+      if(_savedTurtles.size()>0)
       {
-        parseInstanceBrackets(treeString, i, id, age);
+        _turtle = _savedTurtles.back();
+        _savedTurtles.pop_back();
+      }
+      break;
+    }
 
-        t4.translate(lastVertex.m_x, lastVertex.m_y, lastVertex.m_z);
+    //roll clockwise
+    case '/':
+    {
+      paramVar = _turtle.m_angle;
+      parseBrackets(_treeString, _i, paramVar, _parameterError);
+      _rotationCache.getSinCos(paramVar, sinAngle, cosAngle);
+      _turtle.roll(sinAngle, cosAngle);
+      break;
+    }
 
-        ngl::Vec3 k = right.cross(dir);
-        ngl::Mat4 transform(right.m_x,      right.m_y,      right.m_z,      0,
-                            dir.m_x,        dir.m_y,        dir.m_z,        0,
-                            k.m_x,          k.m_y,          k.m_z,          0,
-                            lastVertex.m_x, lastVertex.m_y, lastVertex.m_z, 1);
+    //roll anticlockwise
+    case '\\':
+    {
+      paramVar = _turtle.m_angle;
+      parseBrackets(_treeString, _i, paramVar, _parameterError);
+      _rotationCache.getSinCos(paramVar, sinAngle, cosAngle);
+      _turtle.roll(-sinAngle, cosAngle);
+      break;
+    }
 
-        for(auto instance : savedInstance)
-        {
-          instance->m_exitPoints.push_back(Instance::ExitPoint(id, age, instance->m_transform.inverse()*transform));
-        }
+    //pitch up
+    case '&':
+    {
+      paramVar = _turtle.m_angle;
+      parseBrackets(_treeString, _i, paramVar, _parameterError);
+      _rotationCache.getSinCos(paramVar, sinAngle, cosAngle);
+      _turtle.pitch(sinAngle, cosAngle);
+      break;
+    }
 
-        if(m_instanceCache.numInstancesAt(id,age)==0)
+    //pitch down
+    case '^':
+    {
+      paramVar = _turtle.m_angle;
+      parseBrackets(_treeString, _i, paramVar, _parameterError);
+      _rotationCache.getSinCos(paramVar, sinAngle, cosAngle);
+      _turtle.pitch(-sinAngle, cosAngle);
+      break;
+    }
+
+    //scale step size
+    case '\"':
+    {
+      paramVar = m_stepScale;
+      parseBrackets(_treeString, _i, paramVar, _parameterError);
+      _turtle.m_stepSize *= paramVar;
+      break;
+    }
+
+    //scale angle
+    case ';':
+    {
+      paramVar = m_angleScale;
+      parseBrackets(_treeString, _i, paramVar, _parameterError);
+      _turtle.m_angle *= paramVar;
+      break;
+    }
+
+    //scale width
+    case '!':
+    {
+      paramVar = m_widthScale;
+      parseBrackets(_treeString, _i, paramVar, _parameterError);
+      _turtle.m_width *= paramVar;
+      break;
+    }
+
+    default:
+    {
+      break;
+    }
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+//a section of the tree string that can be interpreted independently of the rest: either a top-level branch
+//or a piece of the trunk between two top-level branches, along with the geometry it produces
+struct GeometryChunk
+{
+  GeometryChunk(size_t _start, const Turtle &_turtle, bool _isBranch) :
+    m_start(_start), m_end(_start), m_turtle(_turtle), m_isBranch(_isBranch)
+  {
+    //every chunk starts from its own copy of the vertex it branches off, at local index 0
+    m_turtle.m_lastIndex = 0;
+    m_vertices = {m_turtle.m_lastVertex};
+    m_widths = {m_turtle.m_width};
+  }
+
+  size_t m_start;
+  size_t m_end;
+  Turtle m_turtle;
+  bool m_isBranch;
+  std::vector<ngl::Vec3> m_vertices;
+  std::vector<GLuint> m_indices;
+  std::vector<float> m_widths;
+  std::vector<Instance::Leaf> m_leaves;
+  bool m_parameterError = false;
+};
+
+bool LSystem::createGeometryParallel(const std::string &_treeString, GeometrySink &_sink)
+{
+  //instancing commands write to the instance cache so can't be split up, and there's
+  //nothing to gain for strings that are small or have no branches
+  if(_treeString.size() < m_minParallelStringSize ||
+     _treeString.find('[') == std::string::npos ||
+     _treeString.find_first_of("{<") != std::string::npos)
+  {
+    return false;
+  }
+
+  //pre-pass: interpret the trunk directly, and store the turtle state at the start of each top-level branch.
+  //since ']' restores the state from the matching '[', the trunk never depends on what happens inside a branch
+  std::vector<GeometryChunk> chunks = {};
+  std::vector<size_t> branchChunks = {};
+  Turtle turtle(m_stepSize, m_angle, m_width, 0);
+  RotationCache rotationCache;
+  std::vector<Turtle> savedTurtles = {};
+  chunks.push_back(GeometryChunk(0, turtle, false));
+
+  for(size_t i=0; i<_treeString.size(); i++)
+  {
+    if(_treeString[i]=='[')
+    {
+      int bracketCount = 0;
+      size_t j=i+1;
+      for(; j<_treeString.size(); j++)
+      {
+        if(_treeString[j]=='[')
         {
-          instance = Instance(transform);
-          instance.m_instanceStart = indices->size();//&(indices->back());
-          m_instanceCache.pushBackElement(id, age, instance);
-          currentInstance = m_instanceCache.getLastElementAt(id, age);
-          savedInstance.push_back(currentInstance);
+          bracketCount++;
         }
-        else
+        if(_treeString[j]==']')
         {
-          skipToNextChevron(treeString,i);
+          if(bracketCount==0)
+          {
+            break;
+          }
+          bracketCount--;
         }
-
-        break;
       }
+      chunks.back().m_end = i;
+      chunks.back().m_turtle = turtle;
 
-      case '>':
+      branchChunks.push_back(chunks.size());
+      chunks.push_back(GeometryChunk(i+1, turtle, true));
+      chunks.back().m_end = j;
+
+      chunks.push_back(GeometryChunk(j+1, turtle, false));
+      turtle.m_lastIndex = 0;
+      i = j;
+    }
+    else if(_treeString[i]=='~')
+    {
+      GeometryChunk &trunk = chunks.back();
+      trunk.m_leaves.push_back(createLeaf(_treeString, i, turtle, trunk.m_parameterError));
+    }
+    else
+    {
+      GeometryChunk &trunk = chunks.back();
+      BufferSink trunkSink(trunk.m_vertices, trunk.m_indices, trunk.m_widths);
+      turtleCommand(_treeString, i, turtle, savedTurtles, rotationCache, trunkSink, trunk.m_parameterError);
+    }
+  }
+  chunks.back().m_end = _treeString.size();
+  chunks.back().m_turtle = turtle;
+
+  //interpret the branches, with each thread taking the next unclaimed branch until they're all done
+  std::atomic<size_t> nextBranch(0);
+  auto interpretBranches = [&]()
+  {
+    RotationCache branchRotationCache;
+    std::vector<Turtle> branchSavedTurtles = {};
+    branchSavedTurtles.reserve(64);
+    for(size_t b=nextBranch++; b<branchChunks.size(); b=nextBranch++)
+    {
+      GeometryChunk &chunk = chunks[branchChunks[b]];
+      Turtle branchTurtle = chunk.m_turtle;
+      BufferSink branchSink(chunk.m_vertices, chunk.m_indices, chunk.m_widths);
+      branchSavedTurtles.clear();
+      for(size_t i=chunk.m_start; i<chunk.m_end; i++)
       {
-        //note that assuming > doesn't appear in any rules, we will only reach this case if we are using the corresponding < to make an instance
-        currentInstance->m_instanceEnd = indices->size();
-        savedInstance.pop_back();
-        if(savedInstance.size()>0)
+        if(_treeString[i]=='~')
         {
-          currentInstance = savedInstance.back();
+          chunk.m_leaves.push_back(createLeaf(_treeString, i, branchTurtle, chunk.m_parameterError));
+        }
+        else
+        {
+          turtleCommand(_treeString, i, branchTurtle, branchSavedTurtles, branchRotationCache,
+                        branchSink, chunk.m_parameterError);
         }
-        break;
       }
+    }
+  };
 
-      default:
-      {
-        break;
-      }
+  size_t numThreads = std::min(m_numThreads, branchChunks.size());
+  std::vector<std::thread> threads = {};
+  for(size_t t=1; t<numThreads; t++)
+  {
+    threads.push_back(std::thread(interpretBranches));
+  }
+  interpretBranches();
+  for(auto &thread : threads)
+  {
+    thread.join();
+  }
+
+  //merge the chunks into the sink in string order, so the vertices come out in the same order as the serial version.
+  //local index 0 of each chunk is the vertex it started from, which is the end of the latest trunk chunk
+  size_t numVertices = 1;
+  size_t numIndices = 0;
+  for(auto &chunk : chunks)
+  {
+    numVertices += chunk.m_vertices.size()-1;
+    numIndices += chunk.m_indices.size();
+  }
+  _sink.reserve(numVertices, numIndices);
+
+  GLuint startIndex = _sink.addVertex(chunks[0].m_vertices[0], chunks[0].m_widths[0]);
+  std::vector<GLuint> sinkIndices = {};
+  for(auto &chunk : chunks)
+  {
+    sinkIndices.resize(chunk.m_vertices.size());
+    sinkIndices[0] = startIndex;
+    for(size_t v=1; v<chunk.m_vertices.size(); v++)
+    {
+      sinkIndices[v] = _sink.addVertex(chunk.m_vertices[v], chunk.m_widths[v]);
+    }
+    for(size_t k=0; k+1<chunk.m_indices.size(); k+=2)
+    {
+      _sink.addSegment(sinkIndices[chunk.m_indices[k]], sinkIndices[chunk.m_indices[k+1]]);
+    }
+    if(chunk.m_isBranch == false)
+    {
+      startIndex = sinkIndices[chunk.m_turtle.m_lastIndex];
+    }
+    m_leaves.insert(m_leaves.end(), chunk.m_leaves.begin(), chunk.m_leaves.end());
+    if(chunk.m_parameterError)
+    {
+      m_parameterError = true;
     }
   }
+
   if(m_parameterError)
   {
     std::cerr<<"WARNING: unable to parse one or more parameters \n";
     m_parameterError = false;
   }
+  return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+Instance::Leaf LSystem::createLeaf(const std::string &_treeString, size_t &_i, const Turtle &_turtle,
+                                   bool &_parameterError) const
+{
+  float size = m_leafSize;
+  parseBrackets(_treeString, _i, size, _parameterError);
+  return Instance::Leaf(_turtle.transform(), size);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void LSystem::expandByLeaf(BoundingBox &_bounds, const Instance::Leaf &_leaf) const
+{
+  //a card can reach at most its size away from its position in any direction
+  ngl::Vec3 reach(_leaf.m_size, _leaf.m_size, _leaf.m_size);
+  _bounds.expand(_leaf.m_position-reach);
+  _bounds.expand(_leaf.m_position+reach);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 
-void LSystem::parseBrackets(const std::string &_treeString, size_t &_i, float &_paramVar)
+void LSystem::parseBrackets(const std::string &_treeString, size_t &_i, float &_paramVar,
+                            bool &_parameterError) const
 {
   if(_i+1<_treeString.length() && _treeString.at(_i+1)=='(')
   {
@@ -308,11 +613,11 @@ void LSystem::parseBrackets(const std::string &_treeString, size_t &_i, float &_
       }
       catch(std::invalid_argument)
       {
-        m_parameterError = true;
+        _parameterError = true;
       }
       catch(std::out_of_range)
       {
-        m_parameterError = true;
+        _parameterError = true;
       }
       _i=j;
     }
@@ -7,9 +7,13 @@
 #include <regex>
 #include <random>
 #include <chrono>
+#include <atomic>
+#include <thread>
 #include <stdexcept>
 #include <iostream>
 #include <math.h>
+#include <cmath>
+#include <unordered_map>
 #include <string>
 #include <boost/algorithm/string.hpp>
 #include <ngl/Mat3.h>
@@ -49,6 +53,7 @@ void LSystem::addInstancingToRule(std::string &_rhs, float &_prob, int _index)
   int count = 1;
   int instanceCount = 0;
   int nonInstanceCount = 0;
+  std::regex nonTerminals(m_nonTerminals);
   for(size_t i=0; i<_rhs.length(); i++)
   {
     if(_rhs[i]=='[')
@@ -77,7 +82,7 @@ void LSystem::addInstancingToRule(std::string &_rhs, float &_prob, int _index)
       }
       std::string branch(_rhs.begin()+int(i+1),_rhs.begin()+int(j));
       //check that the branch contains at least one non-terminal
-      if(std::regex_search(branch, std::regex(m_nonTerminals)))
+      if(std::regex_search(branch, nonTerminals))
       {
         //if the branch hasn't been added to m_branches already, then add it
         //^BUT THIS BIT SHOULD BE UNNECESSARY - THE BRANCHES HAVE ALREADY ALL BEEN ADDED TO M_BRANCHES BY COUNT BRANCHES
@@ -123,19 +128,520 @@ void LSystem::addInstancingToRule(std::string &_rhs, float &_prob, int _index)
 
 void LSystem::fillInstanceCache(int _numHeroTrees)
 {
+  //the key has to come from the rules before the instancing commands are added
+  std::string cacheFileName = instanceCacheFileName(_numHeroTrees);
+  uint64_t cacheKey = cacheFileName.empty() ? 0 : instanceCacheKey(_numHeroTrees);
+
   seedRandomEngine();
   addInstancingCommands();
   m_instanceCache.resizeCache(m_branches.size(), size_t(m_generation));
+  m_instanceArena = InstanceArena();
+
+  if(cacheFileName.empty() == false && loadInstanceCache(cacheFileName, cacheKey))
+  {
+    return;
+  }
 
   m_forestMode = true;
   m_heroIndices = {};
   m_heroVertices = {};
+  m_heroWidths = {};
+  m_heroQuantisedVertices = {};
+  m_bounds = BoundingBox();
+
 
+  createHeroTrees(_numHeroTrees);
+  if(m_fillMissingInstances)
+  {
+    fillMissingInstances();
+  }
 
-  for(int i=0; i<_numHeroTrees; i++)
+  if(m_deduplicateInstances)
+  {
+    deduplicateInstances();
+  }
+  if(m_instanceIndexBudget > 0 || m_instanceVariantBudget > 0)
   {
-    createGeometry();
+    optimiseInstanceVariety(m_instanceIndexBudget, m_instanceVariantBudget);
   }
+  compactHeroGeometry();
+
+  finishHeroGeometry();
 
   m_forestMode = false;
+
+  if(cacheFileName.empty() == false)
+  {
+    saveInstanceCache(cacheFileName, cacheKey);
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void LSystem::createHeroTrees(int _numHeroTrees)
+{
+  size_t numTrees = size_t(std::max(_numHeroTrees, 0));
+
+  //each tree gets its own seed, mixed with seed_seq since nearby seeds give similar trees, so the result doesn't
+  //depend on how many threads there are or which one makes which tree
+  std::uint32_t baseSeed = std::uint32_t(m_gen());
+  LSystem prototype = heroWorker();
+  size_t numThreads = std::max(size_t(1), std::min(m_numThreads, numTrees));
+
+  //on one thread, the trees are simply made one after another sharing one cache
+  if(numThreads == 1)
+  {
+    LSystem worker = prototype;
+    worker.m_instanceCache.resizeCache(m_branches.size(), size_t(m_generation));
+    for(size_t t=0; t<numTrees; t++)
+    {
+      std::seed_seq seed = {baseSeed, std::uint32_t(t)};
+      worker.m_gen.seed(seed);
+      worker.createGeometry();
+    }
+    HeroTree tree;
+    tree.m_vertices = std::move(worker.m_heroVertices);
+    tree.m_indices = std::move(worker.m_heroIndices);
+    tree.m_widths = std::move(worker.m_heroWidths);
+    tree.m_instanceCache = std::move(worker.m_instanceCache);
+    tree.m_instanceArena = std::move(worker.m_instanceArena);
+    tree.m_bounds = worker.m_bounds;
+    appendHeroTree(tree, false);
+    return;
+  }
+
+  //otherwise every tree is made with its own geometry and instance cache, by a copy of this L-system without the
+  //buffers. The only way a tree depends on the ones before it is '<', which skips a branch if any earlier tree already
+  //filled its slot, so each tree is told which slots the trees before it filled, and records which ones it asked about
+  std::vector<HeroTree> trees(numTrees);
+  std::vector<bool> isMade(numTrees, false);
+  std::vector<std::vector<bool>> madeWith(numTrees);
+  std::vector<std::vector<size_t>> queries(numTrees);
+  CacheStructure<Instance> shape;
+  shape.resizeCache(m_branches.size(), size_t(m_generation));
+  size_t numSlots = shape.numIds()*shape.numAges();
+
+  auto createTrees = [&](const std::vector<size_t> &_toMake)
+  {
+    std::atomic<size_t> nextTree(0);
+    auto createNextTrees = [&]()
+    {
+      LSystem worker = prototype;
+      for(size_t i=nextTree++; i<_toMake.size(); i=nextTree++)
+      {
+        size_t t = _toMake[i];
+        std::seed_seq seed = {baseSeed, std::uint32_t(t)};
+        worker.m_gen.seed(seed);
+        worker.m_heroVertices = {};
+        worker.m_heroIndices = {};
+        worker.m_heroWidths = {};
+        worker.m_bounds = BoundingBox();
+        worker.m_instanceCache.resizeCache(m_branches.size(), size_t(m_generation));
+        worker.m_instanceArena = InstanceArena();
+        worker.m_earlierHeroSlots = madeWith[t];
+        worker.m_earlierHeroQueries = {};
+        worker.createGeometry();
+        trees[t].m_vertices = std::move(worker.m_heroVertices);
+        trees[t].m_indices = std::move(worker.m_heroIndices);
+        trees[t].m_widths = std::move(worker.m_heroWidths);
+        trees[t].m_instanceCache = std::move(worker.m_instanceCache);
+        trees[t].m_instanceArena = std::move(worker.m_instanceArena);
+        trees[t].m_bounds = worker.m_bounds;
+        queries[t] = std::move(worker.m_earlierHeroQueries);
+      }
+    };
+    std::vector<std::thread> threads = {};
+    for(size_t t=1; t<std::min(numThreads, _toMake.size()); t++)
+    {
+      threads.push_back(std::thread(createNextTrees));
+    }
+    createNextTrees();
+    for(auto &thread : threads)
+    {
+      thread.join();
+    }
+    //set here rather than by the workers, since neighbouring flags of a vector<bool> share a word
+    for(auto t : _toMake)
+    {
+      isMade[t] = true;
+    }
+  };
+
+  //the first tree fills most of the slots '<' is used for, so it's made before the others guess what's filled
+  madeWith[0].assign(numSlots, false);
+  createTrees({0});
+  //a tree needs making again if anything it asked about has changed in the trees before it. The first such tree only
+  //has correct trees before it, so it's correct after being made again, but that's all a round promises, so a chain
+  //of dependent trees could take numTrees rounds. After a few rounds the rest are made again one at a time in order,
+  //each with the trees before it already correct, so no more than numTrees are ever made again after that
+  const size_t maxParallelRounds = 4;
+  for(size_t round=0; true; round++)
+  {
+    bool isSerial = round >= maxParallelRounds;
+    std::vector<size_t> toMake = {};
+    std::vector<bool> filled(numSlots, false);
+    for(size_t t=0; t<numTrees; t++)
+    {
+      bool isCorrect = isMade[t];
+      for(size_t q=0; isCorrect && q<queries[t].size(); q++)
+      {
+        isCorrect = madeWith[t][queries[t][q]] == filled[queries[t][q]];
+      }
+      if(isCorrect == false)
+      {
+        madeWith[t] = filled;
+        if(isSerial)
+        {
+          createTrees({t});
+        }
+        else
+        {
+          toMake.push_back(t);
+        }
+      }
+      if(isMade[t])
+      {
+        markFilledSlots(trees[t].m_instanceCache, filled);
+      }
+    }
+    if(toMake.empty())
+    {
+      break;
+    }
+    createTrees(toMake);
+  }
+
+  //merge the trees in order. An instance is only kept if there was still room for it at that id and age, as if the
+  //trees had been made one after another sharing the cache. Geometry only used by instances that weren't kept is
+  //removed by compactHeroGeometry
+  for(auto &tree : trees)
+  {
+    appendHeroTree(tree, false);
+    tree = HeroTree();
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void LSystem::markFilledSlots(const CacheStructure<Instance> &_cache, std::vector<bool> &_slots)
+{
+  for(size_t s=0; s<_cache.numSlots(); s++)
+  {
+    size_t slot = _cache.slotId(s)*_cache.numAges()+_cache.slotAge(s);
+    if(slot < _slots.size() && _cache.numInstancesAt(_cache.slotId(s), _cache.slotAge(s)) > 0)
+    {
+      _slots[slot] = true;
+    }
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+LSystem LSystem::heroWorker() const
+{
+  LSystem worker = *this;
+  worker.m_vertices = {};
+  worker.m_indices = {};
+  worker.m_widths = {};
+  worker.m_tubeVertices = {};
+  worker.m_tubeIndices = {};
+  worker.m_stripIndices = {};
+  worker.m_leaves = {};
+  worker.m_heroVertices = {};
+  worker.m_heroIndices = {};
+  worker.m_heroWidths = {};
+  worker.m_heroTubeVertices = {};
+  worker.m_heroTubeIndices = {};
+  worker.m_heroStripIndices = {};
+  worker.m_heroQuantisedVertices = {};
+  worker.m_instanceCache = CacheStructure<Instance>();
+  worker.m_instanceArena = InstanceArena();
+  worker.m_earlierHeroSlots = {};
+  worker.m_earlierHeroQueries = {};
+  worker.m_forestMode = true;
+  return worker;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void LSystem::appendHeroTree(HeroTree &_tree, bool _onlyEmptySlots)
+{
+  //quantising empties m_heroVertices, so go back to full precision before adding to them
+  dequantiseHeroVertices();
+
+  //the tree's indices and instance ranges move along to where its geometry ends up
+  GLuint vertexOffset = GLuint(m_heroVertices.size());
+  size_t indexOffset = m_heroIndices.size();
+  m_heroVertices.insert(m_heroVertices.end(), _tree.m_vertices.begin(), _tree.m_vertices.end());
+  m_heroWidths.insert(m_heroWidths.end(), _tree.m_widths.begin(), _tree.m_widths.end());
+  m_heroIndices.reserve(m_heroIndices.size()+_tree.m_indices.size());
+  for(auto index : _tree.m_indices)
+  {
+    m_heroIndices.push_back(index+vertexOffset);
+  }
+  m_bounds.expand(_tree.m_bounds);
+
+  _tree.m_instanceCache.forEachElement([&](Instance &_instance, size_t _id, size_t _age, size_t)
+  {
+    size_t numInstances = m_instanceCache.numInstancesAt(_id,_age);
+    if(_onlyEmptySlots ? numInstances == 0 : numInstances <= size_t(m_maxInstancePerLevel/(_age+1)))
+    {
+      _instance.m_instanceStart += indexOffset;
+      _instance.m_instanceEnd += indexOffset;
+      m_instanceArena.append(_instance, _tree.m_instanceArena);
+      m_instanceCache.pushBackElement(_id, _age, std::move(_instance));
+    }
+  });
+  m_instanceCache.mergePushedElements();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void LSystem::finishHeroGeometry()
+{
+  //when more geometry is added after the hero trees have been finished, start again from full precision vertices
+  dequantiseHeroVertices();
+
+  //simplify all the hero trees at once, at the end, so the instance ranges only need updating once
+  if(m_simplify)
+  {
+    std::vector<size_t*> instanceRanges = {};
+    m_instanceCache.forEachElement([&](Instance &_instance, size_t, size_t, size_t)
+    {
+      instanceRanges.push_back(&_instance.m_instanceStart);
+      instanceRanges.push_back(&_instance.m_instanceEnd);
+    });
+    simplifyGeometry(m_heroVertices, m_heroIndices, m_heroWidths, instanceRanges);
+  }
+
+  if(m_stripMode)
+  {
+    std::vector<size_t> instanceRanges = {};
+    m_instanceCache.forEachElement([&](Instance &_instance, size_t, size_t, size_t)
+    {
+      instanceRanges.push_back(_instance.m_instanceStart);
+      instanceRanges.push_back(_instance.m_instanceEnd);
+    });
+    std::vector<size_t> stripRanges = {};
+    createLineStrips(m_heroIndices, m_heroStripIndices, instanceRanges, stripRanges);
+    size_t i = 0;
+    m_instanceCache.forEachElement([&](Instance &_instance, size_t, size_t, size_t)
+    {
+      _instance.m_stripStart = stripRanges[i++];
+      _instance.m_stripEnd = stripRanges[i++];
+    });
+  }
+
+  //instance ranges carry straight over to the tube mesh, see tubeIndex()
+  if(m_tubeMode)
+  {
+    createTubeMesh(m_heroVertices, m_heroWidths, m_heroIndices, m_heroTubeVertices, m_heroTubeIndices);
+  }
+  else if(m_quantiseHeroVertices)
+  {
+    quantiseHeroVertices();
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void LSystem::deduplicateInstances()
+{
+  //each instance is reduced to a list of integers describing everything that's drawn for it, relative to its own
+  //transform: the position and width of every index in its range, then its exit points and leaves
+  float scale = 1.0f/m_deduplicateTolerance;
+  auto quantise = [&](float _value) { return int64_t(std::llround(double(_value*scale))); };
+  auto addMatrix = [&](std::vector<int64_t> &_key, const ngl::Mat4 &_matrix)
+  {
+    for(int row=0; row<4; row++)
+    {
+      for(int col=0; col<4; col++)
+      {
+        _key.push_back(quantise(_matrix.m_m[row][col]));
+      }
+    }
+  };
+
+  std::vector<std::vector<int64_t>> keys = {};
+  keys.reserve(m_instanceCache.numElements());
+  m_instanceCache.forEachElement([&](Instance &_instance, size_t, size_t, size_t)
+  {
+    std::vector<int64_t> key = {};
+    const ngl::Mat4 &inverse = _instance.m_inverseTransform;
+    for(size_t k=_instance.m_instanceStart; k<_instance.m_instanceEnd; k++)
+    {
+      //same row layout as the instance transforms, see BoundingBox::transformed
+      GLuint index = m_heroIndices[k];
+      const ngl::Vec3 &v = m_heroVertices[index];
+      for(int col=0; col<3; col++)
+      {
+        key.push_back(quantise(v.m_x*inverse.m_m[0][col] + v.m_y*inverse.m_m[1][col] + v.m_z*inverse.m_m[2][col] +
+                               inverse.m_m[3][col]));
+      }
+      key.push_back(quantise(m_heroWidths[index]));
+    }
+    key.push_back(int64_t(_instance.m_numExitPoints));
+    for(auto &exitPoint : m_instanceArena.exitPoints(_instance))
+    {
+      key.push_back(int64_t(exitPoint.m_exitId));
+      key.push_back(int64_t(exitPoint.m_exitAge));
+      addMatrix(key, exitPoint.m_exitTransform);
+    }
+    key.push_back(int64_t(_instance.m_numLeaves));
+    for(auto &leaf : m_instanceArena.leaves(_instance))
+    {
+      addMatrix(key, leaf.transform());
+    }
+    keys.push_back(std::move(key));
+  });
+
+  //within each id and age, hash the keys to find candidates and compare them in full to confirm a match
+  std::vector<char> removed(keys.size(), 0);
+  std::unordered_map<uint64_t, std::vector<size_t>> survivors;
+  size_t flatIndex = 0;
+  size_t lastId = size_t(-1), lastAge = size_t(-1);
+  std::vector<Instance*> instances = {};
+  m_instanceCache.forEachElement([&](Instance &_instance, size_t _id, size_t _age, size_t)
+  {
+    if(_id != lastId || _age != lastAge)
+    {
+      survivors.clear();
+      lastId = _id;
+      lastAge = _age;
+    }
+    instances.push_back(&_instance);
+    const std::vector<int64_t> &key = keys[flatIndex];
+    uint64_t hash = 14695981039346656037ULL;
+    for(auto value : key)
+    {
+      hash = (hash ^ uint64_t(value)) * 1099511628211ULL;
+    }
+    std::vector<size_t> &candidates = survivors[hash];
+    for(auto candidate : candidates)
+    {
+      if(keys[candidate] == key)
+      {
+        instances[candidate]->m_weight += _instance.m_weight;
+        removed[flatIndex] = 1;
+        break;
+      }
+    }
+    if(removed[flatIndex] == 0)
+    {
+      candidates.push_back(flatIndex);
+    }
+    flatIndex++;
+  });
+
+  flatIndex = 0;
+  m_instanceCache.eraseIf([&](Instance &, size_t, size_t, size_t)
+  {
+    return removed[flatIndex++] != 0;
+  });
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void LSystem::dequantiseHeroVertices()
+{
+  if(m_heroQuantisedVertices.empty() == false)
+  {
+    m_heroVertices.resize(m_heroQuantisedVertices.size()/3);
+    for(size_t i=0; i<m_heroVertices.size(); i++)
+    {
+      m_heroVertices[i] = heroVertex(i);
+    }
+    m_heroQuantisedVertices = {};
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void LSystem::compactHeroGeometry()
+{
+  dequantiseHeroVertices();
+
+  //instances that have been removed leave their exit points and leaves behind in the arena
+  InstanceArena arena;
+  arena.m_exitPoints.reserve(m_instanceArena.m_exitPoints.size());
+  arena.m_leaves.reserve(m_instanceArena.m_leaves.size());
+  m_instanceCache.forEachElement([&](Instance &_instance, size_t, size_t, size_t)
+  {
+    arena.append(_instance, m_instanceArena);
+  });
+  arena.m_exitPoints.shrink_to_fit();
+  arena.m_leaves.shrink_to_fit();
+  m_instanceArena = std::move(arena);
+  std::vector<Instance*> instances = {};
+  m_instanceCache.forEachElement([&](Instance &_instance, size_t, size_t, size_t)
+  {
+    instances.push_back(&_instance);
+  });
+
+  //instance ranges can nest or overlap, so merge them into separate spans of the index list
+  std::vector<std::pair<size_t,size_t>> spans = {};
+  for(auto instance : instances)
+  {
+    spans.push_back(std::make_pair(instance->m_instanceStart, instance->m_instanceEnd));
+  }
+  std::sort(spans.begin(), spans.end());
+  std::vector<std::pair<size_t,size_t>> mergedSpans = {};
+  for(auto &span : spans)
+  {
+    if(mergedSpans.empty() == false && span.first <= mergedSpans.back().second)
+    {
+      mergedSpans.back().second = std::max(mergedSpans.back().second, span.second);
+    }
+    else
+    {
+      mergedSpans.push_back(span);
+    }
+  }
+
+  //only keep the indices inside a span, and only the vertices those indices use
+  std::vector<GLuint> indices = {};
+  std::vector<size_t> spanStart(mergedSpans.size());
+  for(size_t s=0; s<mergedSpans.size(); s++)
+  {
+    spanStart[s] = indices.size();
+    indices.insert(indices.end(), m_heroIndices.begin()+long(mergedSpans[s].first),
+                   m_heroIndices.begin()+long(mergedSpans[s].second));
+  }
+
+  std::vector<GLuint> newIndex(m_heroVertices.size(), 0);
+  std::vector<bool> used(m_heroVertices.size(), false);
+  for(auto index : indices)
+  {
+    used[index] = true;
+  }
+  size_t numVertices = 0;
+  for(size_t v=0; v<m_heroVertices.size(); v++)
+  {
+    if(used[v])
+    {
+      newIndex[v] = GLuint(numVertices);
+      m_heroVertices[numVertices] = m_heroVertices[v];
+      m_heroWidths[numVertices] = m_heroWidths[v];
+      numVertices++;
+    }
+  }
+  m_heroVertices.resize(numVertices);
+  m_heroVertices.shrink_to_fit();
+  m_heroWidths.resize(numVertices);
+  m_heroWidths.shrink_to_fit();
+  for(auto &index : indices)
+  {
+    index = newIndex[index];
+  }
+  m_heroIndices = std::move(indices);
+
+  //each instance range lies inside one span, so it moves by the same amount as the start of that span
+  for(auto instance : instances)
+  {
+    auto span = std::upper_bound(mergedSpans.begin(), mergedSpans.end(),
+                                 std::make_pair(instance->m_instanceStart, size_t(-1)))-1;
+    size_t offset = spanStart[size_t(span-mergedSpans.begin())];
+    instance->m_instanceStart = offset + instance->m_instanceStart - span->first;
+    instance->m_instanceEnd = offset + instance->m_instanceEnd - span->first;
+  }
 }
@@ -0,0 +1,55 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file LSystem_LineStrips.cpp
+/// @brief implementation file for LSystem class methods that convert the line geometry to line strips
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include "LSystem.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void LSystem::createLineStrips(const std::vector<GLuint> &_indices, std::vector<GLuint> &_stripIndices,
+                               const std::vector<size_t> &_boundaries, std::vector<size_t> &_stripBoundaries) const
+{
+  size_t numSegments = _indices.size()/2;
+
+  std::vector<bool> isBoundary(_indices.size()+1, false);
+  for(auto boundary : _boundaries)
+  {
+    isBoundary[std::min(boundary, _indices.size())] = true;
+  }
+
+  //an unbranched chain of n segments becomes n+1 indices instead of 2n, at the cost of one restart index
+  //whenever a segment doesn't carry on from the end of the last one
+  _stripIndices.clear();
+  _stripIndices.reserve(_indices.size());
+  std::vector<size_t> segmentStart(numSegments+1);
+  for(size_t k=0; k<numSegments; k++)
+  {
+    GLuint a = _indices[2*k];
+    GLuint b = _indices[2*k+1];
+    if(_stripIndices.empty() || _stripIndices.back() != a || isBoundary[2*k])
+    {
+      if(_stripIndices.empty() == false)
+      {
+        _stripIndices.push_back(RESTART_INDEX);
+      }
+      segmentStart[k] = _stripIndices.size();
+      _stripIndices.push_back(a);
+    }
+    else
+    {
+      segmentStart[k] = _stripIndices.size()-1;
+    }
+    _stripIndices.push_back(b);
+  }
+  segmentStart[numSegments] = _stripIndices.size();
+
+  //every boundary starts a new strip, so a range between two boundaries covers whole strips (plus possibly a
+  //trailing restart, which draws nothing)
+  _stripBoundaries.resize(_boundaries.size());
+  for(size_t i=0; i<_boundaries.size(); i++)
+  {
+    _stripBoundaries[i] = segmentStart[std::min(_boundaries[i], 2*numSegments)/2];
+  }
+}
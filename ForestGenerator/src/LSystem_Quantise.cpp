@@ -0,0 +1,91 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file LSystem_Quantise.cpp
+/// @brief implementation file for LSystem class methods that store the hero geometry as 16-bit positions
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <math.h>
+#include <ngl/Vec3.h>
+#include <ngl/Mat4.h>
+#include "LSystem.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void LSystem::quantiseHeroVertices()
+{
+  m_heroQuantisedVertices = {};
+  if(m_heroVertices.empty())
+  {
+    return;
+  }
+
+  ngl::Vec3 minCorner = m_heroVertices[0];
+  ngl::Vec3 maxCorner = m_heroVertices[0];
+  for(auto &v : m_heroVertices)
+  {
+    minCorner.m_x = std::min(minCorner.m_x, v.m_x);
+    minCorner.m_y = std::min(minCorner.m_y, v.m_y);
+    minCorner.m_z = std::min(minCorner.m_z, v.m_z);
+    maxCorner.m_x = std::max(maxCorner.m_x, v.m_x);
+    maxCorner.m_y = std::max(maxCorner.m_y, v.m_y);
+    maxCorner.m_z = std::max(maxCorner.m_z, v.m_z);
+  }
+
+  //positions are stored relative to the centre of the bounding box, with each axis scaled so the box fills
+  //-32767 to 32767. A flat axis keeps a scale of 1 so it still dequantises to the centre
+  m_heroQuantiseCentre = 0.5f*(minCorner+maxCorner);
+  ngl::Vec3 halfExtent = 0.5f*(maxCorner-minCorner);
+  m_heroQuantiseScale.m_x = halfExtent.m_x > 0 ? halfExtent.m_x/32767.0f : 1.0f;
+  m_heroQuantiseScale.m_y = halfExtent.m_y > 0 ? halfExtent.m_y/32767.0f : 1.0f;
+  m_heroQuantiseScale.m_z = halfExtent.m_z > 0 ? halfExtent.m_z/32767.0f : 1.0f;
+
+  auto quantise = [](float _value, float _centre, float _scale)
+  {
+    float q = roundf((_value-_centre)/_scale);
+    return GLshort(std::min(std::max(q, -32767.0f), 32767.0f));
+  };
+
+  m_heroQuantisedVertices.resize(3*m_heroVertices.size());
+  for(size_t i=0; i<m_heroVertices.size(); i++)
+  {
+    m_heroQuantisedVertices[3*i] = quantise(m_heroVertices[i].m_x, m_heroQuantiseCentre.m_x, m_heroQuantiseScale.m_x);
+    m_heroQuantisedVertices[3*i+1] = quantise(m_heroVertices[i].m_y, m_heroQuantiseCentre.m_y, m_heroQuantiseScale.m_y);
+    m_heroQuantisedVertices[3*i+2] = quantise(m_heroVertices[i].m_z, m_heroQuantiseCentre.m_z, m_heroQuantiseScale.m_z);
+  }
+
+  //the quantised copy replaces the full precision one
+  std::vector<ngl::Vec3>().swap(m_heroVertices);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+ngl::Vec3 LSystem::heroVertex(size_t _index) const
+{
+  if(m_heroQuantisedVertices.empty())
+  {
+    return m_heroVertices[_index];
+  }
+  return ngl::Vec3(m_heroQuantiseCentre.m_x + m_heroQuantiseScale.m_x*m_heroQuantisedVertices[3*_index],
+                   m_heroQuantiseCentre.m_y + m_heroQuantiseScale.m_y*m_heroQuantisedVertices[3*_index+1],
+                   m_heroQuantiseCentre.m_z + m_heroQuantiseScale.m_z*m_heroQuantisedVertices[3*_index+2]);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+ngl::Mat4 LSystem::dequantiseTransform(const ngl::Mat4 &_transform) const
+{
+  //a vertex v is drawn at v.x*row0 + v.y*row1 + v.z*row2 + row3 of the transform, so scaling the first three rows
+  //and moving the centre into the last row gives the same result for the quantised position
+  ngl::Mat4 folded = _transform;
+  float scale[3] = {m_heroQuantiseScale.m_x, m_heroQuantiseScale.m_y, m_heroQuantiseScale.m_z};
+  float centre[3] = {m_heroQuantiseCentre.m_x, m_heroQuantiseCentre.m_y, m_heroQuantiseCentre.m_z};
+  for(int col=0; col<4; col++)
+  {
+    for(int row=0; row<3; row++)
+    {
+      folded.m_m[3][col] += centre[row]*_transform.m_m[row][col];
+      folded.m_m[row][col] = scale[row]*_transform.m_m[row][col];
+    }
+  }
+  return folded;
+}
@@ -0,0 +1,93 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file LSystem_Simplify.cpp
+/// @brief implementation file for LSystem class methods that reduce the number of vertices in the line geometry
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <math.h>
+#include <ngl/Vec3.h>
+#include "LSystem.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void LSystem::simplifyGeometry(std::vector<ngl::Vec3> &_vertices, std::vector<GLuint> &_indices,
+                               std::vector<float> &_widths, const std::vector<size_t*> &_boundaries) const
+{
+  size_t numSegments = _indices.size()/2;
+
+  //a vertex can only be removed if it's used by exactly two segments, so branch points are always kept
+  std::vector<unsigned char> useCount(_vertices.size(), 0);
+  for(auto index : _indices)
+  {
+    if(useCount[index] < 255)
+    {
+      useCount[index]++;
+    }
+  }
+  //segments are never merged across an index position that something else refers to, eg. an instance range
+  std::vector<bool> isBoundary(_indices.size()+1, false);
+  for(auto boundary : _boundaries)
+  {
+    isBoundary[std::min(*boundary, _indices.size())] = true;
+  }
+
+  //rounding errors mean consecutive F segments are never exactly parallel, so zero tolerance still allows a little
+  float cosTolerance = std::min(cosf(float(M_PI)*m_simplifyAngle/180.0f), 1.0f-1e-6f);
+
+  std::vector<GLuint> indices = {};
+  indices.reserve(_indices.size());
+  std::vector<size_t> segmentStart(numSegments+1);
+  std::vector<bool> removed(_vertices.size(), false);
+  ngl::Vec3 runDir(0,0,0);
+  for(size_t k=0; k<numSegments; k++)
+  {
+    segmentStart[k] = indices.size();
+    GLuint a = _indices[2*k];
+    GLuint b = _indices[2*k+1];
+    ngl::Vec3 dir = _vertices[b]-_vertices[a];
+    float length = dir.length();
+
+    //compare against the direction of the first segment in the run, so a gentle curve can't drift
+    //further than the tolerance one small step at a time
+    if(indices.empty() == false && indices.back() == a && useCount[a] == 2 && isBoundary[2*k] == false &&
+       _widths[a] == _widths[b] && _widths[indices[indices.size()-2]] == _widths[a] &&
+       length > 0 && runDir.dot(dir) >= cosTolerance*length)
+    {
+      indices.back() = b;
+      removed[a] = true;
+    }
+    else
+    {
+      indices.push_back(a);
+      indices.push_back(b);
+      runDir = length > 0 ? dir/length : ngl::Vec3(0,0,0);
+    }
+  }
+  segmentStart[numSegments] = indices.size();
+
+  //pack the remaining vertices down, keeping them in the same order
+  std::vector<GLuint> newIndex(_vertices.size());
+  size_t numVertices = 0;
+  for(size_t v=0; v<_vertices.size(); v++)
+  {
+    if(removed[v] == false)
+    {
+      newIndex[v] = GLuint(numVertices);
+      _vertices[numVertices] = _vertices[v];
+      _widths[numVertices] = _widths[v];
+      numVertices++;
+    }
+  }
+  _vertices.resize(numVertices);
+  _widths.resize(numVertices);
+  for(auto &index : indices)
+  {
+    index = newIndex[index];
+  }
+  _indices = std::move(indices);
+
+  for(auto boundary : _boundaries)
+  {
+    *boundary = segmentStart[std::min(*boundary, 2*numSegments)/2];
+  }
+}
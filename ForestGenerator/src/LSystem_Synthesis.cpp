@@ -0,0 +1,128 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file LSystem_Synthesis.cpp
+/// @brief implementation file for LSystem class methods that make instances for single empty slots of the instance
+/// cache, rather than hoping a whole hero tree happens to reach them
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <random>
+#include <mutex>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <unordered_set>
+#include <ngl/Mat4.h>
+#include "LSystem.h"
+#include "GeometrySink.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+
+bool LSystem::synthesiseInstance(size_t _id, size_t _age, LSystem &_worker)
+{
+  if(_id >= m_branches.size() || _id >= m_instanceCache.numIds() || _age >= m_instanceCache.numAges())
+  {
+    std::cerr<<"WARNING: can't synthesise an instance at id "<<_id<<", age "<<_age<<"\n";
+    return false;
+  }
+  if(m_instanceCache.numInstancesAt(_id,_age) > 0)
+  {
+    return true;
+  }
+
+  //the same instancing command the rules would have written for this branch at this age, see addInstancingToRule
+  std::string treeString;
+  if(_id == 0)
+  {
+    treeString = "{(0,0)" + m_branches[0] + "}";
+  }
+  else
+  {
+    treeString = "{(" + std::to_string(_id) + "," + std::to_string(_age) + ")[" + m_branches[_id] + "]}";
+  }
+
+  //each slot gets its own random engine, so what it's filled with doesn't depend on which other slots were missing
+  std::seed_seq seed = {std::uint32_t(m_seed), std::uint32_t(_id), std::uint32_t(_age)};
+  std::default_random_engine gen(seed);
+  treeString = deriveString(treeString, int(_age), gen);
+
+  HeroTree tree;
+  _worker.m_instanceCache.resizeCache(m_instanceCache.numIds(), m_instanceCache.numAges()-1);
+  _worker.m_instanceArena.clear();
+  //a '<' branch whose slot is already filled is skipped, just as it would have been in a hero tree
+  _worker.m_earlierHeroSlots.assign(m_instanceCache.numIds()*m_instanceCache.numAges(), false);
+  _worker.m_earlierHeroQueries = {};
+  markFilledSlots(m_instanceCache, _worker.m_earlierHeroSlots);
+  BufferSink sink(tree.m_vertices, tree.m_indices, tree.m_widths);
+  _worker.interpretTreeString(treeString, sink);
+  for(auto &vertex : tree.m_vertices)
+  {
+    tree.m_bounds.expand(vertex);
+  }
+  tree.m_instanceCache = std::move(_worker.m_instanceCache);
+  tree.m_instanceArena = std::move(_worker.m_instanceArena);
+
+  //nested instances are kept too, but only where they fill another empty slot
+  appendHeroTree(tree, true);
+  return m_instanceCache.numInstancesAt(_id,_age) > 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void LSystem::fillMissingInstances()
+{
+  if(m_instanceCache.numIds() == 0)
+  {
+    return;
+  }
+  LSystem worker = heroWorker();
+
+  //each slot is only tried once, since a branch that never reaches its own instancing command can't be filled
+  std::unordered_set<size_t> tried = {};
+  std::vector<std::pair<size_t, size_t>> missing = {};
+  do
+  {
+    missing.clear();
+    auto addIfMissing = [&](size_t _id, size_t _age)
+    {
+      if(_id < m_instanceCache.numIds() && _age < m_instanceCache.numAges() &&
+         m_instanceCache.numInstancesAt(_id,_age) == 0 && tried.insert(_id*m_instanceCache.numAges()+_age).second)
+      {
+        missing.push_back(std::make_pair(_id,_age));
+      }
+    };
+    addIfMissing(0,0);
+    m_instanceCache.forEachElement([&](Instance &_instance, size_t, size_t, size_t)
+    {
+      for(auto &exitPoint : m_instanceArena.exitPoints(_instance))
+      {
+        addIfMissing(exitPoint.m_exitId, exitPoint.m_exitAge);
+      }
+    });
+
+    //synthesising can fill later slots in the list too, which synthesiseInstance skips
+    for(auto &slot : missing)
+    {
+      synthesiseInstance(slot.first, slot.second, worker);
+    }
+  } while(missing.empty() == false);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+bool LSystem::addMissingInstance(size_t _id, size_t _age)
+{
+  std::lock_guard<std::mutex> lock(m_synthesisMutex.m_mutex);
+  if(_id < m_instanceCache.numIds() && _age < m_instanceCache.numAges() &&
+     m_instanceCache.numInstancesAt(_id,_age) > 0)
+  {
+    return true;
+  }
+
+  LSystem worker = heroWorker();
+  bool filled = synthesiseInstance(_id, _age, worker);
+  if(filled)
+  {
+    finishHeroGeometry();
+  }
+  return filled;
+}
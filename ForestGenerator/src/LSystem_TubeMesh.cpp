@@ -0,0 +1,122 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file LSystem_TubeMesh.cpp
+/// @brief implementation file for LSystem class methods that turn the line geometry into a tube mesh
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <math.h>
+#include <ngl/Vec3.h>
+#include "LSystem.h"
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define TUBE_USE_SSE
+#endif
+
+//----------------------------------------------------------------------------------------------------------------------
+
+//writes the _numSides vertices of a ring of radius _radius around _centre, in the plane spanned by _u and _v,
+//to _ring. With SSE, four ring vertices are calculated at once and shuffled from xxxx/yyyy/zzzz into xyz order
+static void writeRing(ngl::Vec3 * _ring, const ngl::Vec3 &_centre, const ngl::Vec3 &_u, const ngl::Vec3 &_v,
+                      float _radius, const float * _cos, const float * _sin, size_t _numSides)
+{
+  size_t k=0;
+#ifdef TUBE_USE_SSE
+  __m128 cx = _mm_set1_ps(_centre.m_x);
+  __m128 cy = _mm_set1_ps(_centre.m_y);
+  __m128 cz = _mm_set1_ps(_centre.m_z);
+  __m128 ux = _mm_set1_ps(_radius*_u.m_x);
+  __m128 uy = _mm_set1_ps(_radius*_u.m_y);
+  __m128 uz = _mm_set1_ps(_radius*_u.m_z);
+  __m128 vx = _mm_set1_ps(_radius*_v.m_x);
+  __m128 vy = _mm_set1_ps(_radius*_v.m_y);
+  __m128 vz = _mm_set1_ps(_radius*_v.m_z);
+  for(; k+4<=_numSides; k+=4)
+  {
+    __m128 c = _mm_loadu_ps(_cos+k);
+    __m128 s = _mm_loadu_ps(_sin+k);
+    __m128 x = _mm_add_ps(cx, _mm_add_ps(_mm_mul_ps(c,ux), _mm_mul_ps(s,vx)));
+    __m128 y = _mm_add_ps(cy, _mm_add_ps(_mm_mul_ps(c,uy), _mm_mul_ps(s,vy)));
+    __m128 z = _mm_add_ps(cz, _mm_add_ps(_mm_mul_ps(c,uz), _mm_mul_ps(s,vz)));
+
+    __m128 xy01 = _mm_unpacklo_ps(x, y);                       // x0 y0 x1 y1
+    __m128 xy23 = _mm_unpackhi_ps(x, y);                       // x2 y2 x3 y3
+    __m128 zx01 = _mm_shuffle_ps(z, x, _MM_SHUFFLE(1,1,0,0));  // z0 z0 x1 x1
+    __m128 yz1 = _mm_shuffle_ps(y, z, _MM_SHUFFLE(1,1,1,1));   // y1 y1 z1 z1
+    __m128 zx23 = _mm_shuffle_ps(z, x, _MM_SHUFFLE(3,3,2,2));  // z2 z2 x3 x3
+    __m128 yz3 = _mm_shuffle_ps(y, z, _MM_SHUFFLE(3,3,3,3));   // y3 y3 z3 z3
+
+    float * out = &_ring[k].m_x;
+    _mm_storeu_ps(out,   _mm_shuffle_ps(xy01, zx01, _MM_SHUFFLE(2,0,1,0)));  // x0 y0 z0 x1
+    _mm_storeu_ps(out+4, _mm_shuffle_ps(yz1, xy23, _MM_SHUFFLE(1,0,2,0)));   // y1 z1 x2 y2
+    _mm_storeu_ps(out+8, _mm_shuffle_ps(zx23, yz3, _MM_SHUFFLE(2,0,2,0)));   // z2 x3 y3 z3
+  }
+#endif
+  for(; k<_numSides; k++)
+  {
+    _ring[k] = _centre + _radius*(_cos[k]*_u + _sin[k]*_v);
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void LSystem::createTubeMesh(const std::vector<ngl::Vec3> &_vertices, const std::vector<float> &_widths,
+                             const std::vector<GLuint> &_indices,
+                             std::vector<ngl::Vec3> &_tubeVertices, std::vector<GLuint> &_tubeIndices) const
+{
+  size_t numSides = std::max(m_tubeSides, size_t(3));
+  size_t numSegments = _indices.size()/2;
+
+  //everything is written in place, so allocate the whole mesh up front
+  _tubeVertices.resize(numSegments*2*numSides);
+  _tubeIndices.resize(tubeIndex(numSegments*2));
+
+  std::vector<float> cosTable(numSides);
+  std::vector<float> sinTable(numSides);
+  for(size_t k=0; k<numSides; k++)
+  {
+    float theta = float(2*M_PI*k)/float(numSides);
+    cosTable[k] = cosf(theta);
+    sinTable[k] = sinf(theta);
+  }
+
+  ngl::Vec3 * ringVertex = _tubeVertices.data();
+  GLuint * triangleIndex = _tubeIndices.data();
+  for(size_t s=0; s<numSegments; s++)
+  {
+    GLuint a = _indices[2*s];
+    GLuint b = _indices[2*s+1];
+
+    //build a frame around the segment, using whichever world axis is furthest from the segment as reference
+    ngl::Vec3 dir = _vertices[b]-_vertices[a];
+    dir.normalize();
+    ngl::Vec3 reference = fabsf(dir.m_x)<0.9f ? ngl::Vec3(1,0,0) : ngl::Vec3(0,0,1);
+    ngl::Vec3 u = dir.cross(reference);
+    u.normalize();
+    ngl::Vec3 v = dir.cross(u);
+
+    writeRing(ringVertex, _vertices[a], u, v, _widths[a], cosTable.data(), sinTable.data(), numSides);
+    writeRing(ringVertex+numSides, _vertices[b], u, v, _widths[b], cosTable.data(), sinTable.data(), numSides);
+
+    GLuint base = GLuint(2*s*numSides);
+    for(size_t k=0; k<numSides; k++)
+    {
+      GLuint k0 = base+GLuint(k);
+      GLuint k1 = base+GLuint((k+1)%numSides);
+      GLuint top = GLuint(numSides);
+      *triangleIndex++ = k0;
+      *triangleIndex++ = k1;
+      *triangleIndex++ = k0+top;
+      *triangleIndex++ = k1;
+      *triangleIndex++ = k1+top;
+      *triangleIndex++ = k0+top;
+    }
+    ringVertex += 2*numSides;
+  }
+}
+
+size_t LSystem::tubeIndex(size_t _lineIndex) const
+{
+  //each segment takes 2 line indices and 6 tube indices per side
+  return _lineIndex*3*std::max(m_tubeSides, size_t(3));
+}
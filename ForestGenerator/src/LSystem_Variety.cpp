@@ -0,0 +1,231 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file LSystem_Variety.cpp
+/// @brief implementation file for LSystem class methods that choose how many instances to keep at each id and age
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <queue>
+#include <iostream>
+#include <cmath>
+#include <utility>
+#include "LSystem.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+
+std::vector<float> LSystem::estimateInstanceUsage()
+{
+  size_t numSlots = m_instanceCache.numSlots();
+  std::vector<float> slotUsage(numSlots, 0.0f);
+  std::vector<float> usage(m_instanceCache.numElements(), 0.0f);
+  size_t trunk = m_instanceCache.findSlot(0,0);
+  if(trunk == numSlots)
+  {
+    return usage;
+  }
+  slotUsage[trunk] = 1.0f;
+
+  //exit points always lead to an older age than the instance they're in, so going through the slots by age, every
+  //slot has had all its use passed on to it before its own instances are reached
+  std::vector<size_t> order(numSlots);
+  for(size_t s=0; s<numSlots; s++)
+  {
+    order[s] = s;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t _a, size_t _b)
+  {
+    return m_instanceCache.slotAge(_a) < m_instanceCache.slotAge(_b);
+  });
+  for(auto s : order)
+  {
+    size_t begin = m_instanceCache.m_offsets[s];
+    size_t end = m_instanceCache.m_offsets[s+1];
+    size_t totalWeight = 0;
+    for(size_t e=begin; e<end; e++)
+    {
+      totalWeight += m_instanceCache.m_elements[e].m_weight;
+    }
+    for(size_t e=begin; e<end; e++)
+    {
+      Instance &instance = m_instanceCache.m_elements[e];
+      usage[e] = slotUsage[s]*float(instance.m_weight)/float(totalWeight);
+      for(auto &exitPoint : m_instanceArena.exitPoints(instance))
+      {
+        size_t exitSlot = m_instanceCache.findSlot(exitPoint.m_exitId, exitPoint.m_exitAge);
+        if(exitSlot != numSlots)
+        {
+          slotUsage[exitSlot] += usage[e];
+        }
+      }
+    }
+  }
+  return usage;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void LSystem::optimiseInstanceVariety(size_t _indexBudget, size_t _variantBudget, std::vector<float> _usage)
+{
+  size_t numElements = m_instanceCache.numElements();
+  if(numElements == 0 || (_indexBudget == 0 && _variantBudget == 0))
+  {
+    return;
+  }
+  if(_usage.size() != numElements)
+  {
+    if(_usage.empty() == false)
+    {
+      std::cerr<<"WARNING: instance usage doesn't match the instance cache, estimating it instead \n";
+    }
+    _usage = estimateInstanceUsage();
+  }
+
+  //what each instance costs, how much it's used and a rough description of its shape to compare it by
+  struct Variant
+  {
+    size_t m_slot;
+    size_t m_numIndices;
+    float m_usage;
+    float m_shape[4];
+  };
+  std::vector<Variant> variants(numElements);
+  for(size_t s=0; s<m_instanceCache.numSlots(); s++)
+  {
+    for(size_t e=m_instanceCache.m_offsets[s]; e<m_instanceCache.m_offsets[s+1]; e++)
+    {
+      const Instance &instance = m_instanceCache.m_elements[e];
+      Variant &variant = variants[e];
+      variant.m_slot = s;
+      variant.m_numIndices = instance.m_instanceEnd-instance.m_instanceStart;
+      variant.m_usage = _usage[e];
+      variant.m_shape[0] = instance.m_bounds.radius();
+      variant.m_shape[1] = float(variant.m_numIndices);
+      variant.m_shape[2] = float(instance.m_numExitPoints);
+      variant.m_shape[3] = float(instance.m_numLeaves);
+    }
+  }
+
+  //0 for the same shape, up to 1 for completely different
+  auto difference = [&](size_t _a, size_t _b)
+  {
+    float result = 0.0f;
+    for(int k=0; k<4; k++)
+    {
+      float largest = std::max(std::fabs(variants[_a].m_shape[k]), std::fabs(variants[_b].m_shape[k]));
+      if(largest > 0.0f)
+      {
+        result += std::fabs(variants[_a].m_shape[k]-variants[_b].m_shape[k])/largest;
+      }
+    }
+    return result*0.25f;
+  };
+
+  std::vector<std::vector<size_t>> keptInSlot(m_instanceCache.numSlots());
+  std::vector<bool> kept(numElements, false);
+  size_t usedIndices = 0;
+  size_t usedVariants = 0;
+  auto keep = [&](size_t _e)
+  {
+    kept[_e] = true;
+    keptInSlot[variants[_e].m_slot].push_back(_e);
+    usedIndices += variants[_e].m_numIndices;
+    usedVariants++;
+  };
+
+  //every slot has to keep something, since exit points only say which slot to draw next
+  for(size_t s=0; s<keptInSlot.size(); s++)
+  {
+    size_t mostUsed = m_instanceCache.m_offsets[s];
+    for(size_t e=mostUsed+1; e<m_instanceCache.m_offsets[s+1]; e++)
+    {
+      if(variants[e].m_usage > variants[mostUsed].m_usage)
+      {
+        mostUsed = e;
+      }
+    }
+    keep(mostUsed);
+  }
+  if((_indexBudget > 0 && usedIndices > _indexBudget) || (_variantBudget > 0 && usedVariants > _variantBudget))
+  {
+    std::cerr<<"WARNING: instance budget is too small for one instance at each id and age, keeping one anyway \n";
+  }
+
+  auto fits = [&](size_t _e)
+  {
+    return (_indexBudget == 0 || usedIndices+variants[_e].m_numIndices <= _indexBudget) &&
+           (_variantBudget == 0 || usedVariants+1 <= _variantBudget);
+  };
+  //what keeping an instance is worth per share of the budgets it uses up
+  auto score = [&](size_t _e)
+  {
+    float diversity = 1.0f;
+    for(auto other : keptInSlot[variants[_e].m_slot])
+    {
+      diversity = std::min(diversity, difference(_e, other));
+    }
+    float price = 0.0f;
+    if(_indexBudget > 0)
+    {
+      price += float(std::max(variants[_e].m_numIndices, size_t(1)))/float(_indexBudget);
+    }
+    if(_variantBudget > 0)
+    {
+      price += 1.0f/float(_variantBudget);
+    }
+    return variants[_e].m_usage*diversity/price;
+  };
+
+  //keeping an instance only makes the others in its slot less different, so scores never go up. That means a score
+  //that's still the highest after being brought up to date really is the best choice left
+  std::priority_queue<std::pair<float,size_t>> candidates;
+  for(size_t e=0; e<numElements; e++)
+  {
+    if(kept[e] == false)
+    {
+      candidates.push(std::make_pair(score(e), e));
+    }
+  }
+  while(candidates.empty() == false)
+  {
+    size_t e = candidates.top().second;
+    candidates.pop();
+    if(fits(e) == false)
+    {
+      continue;
+    }
+    float current = score(e);
+    //unused, or the same as something already kept
+    if(current <= 0.0f)
+    {
+      continue;
+    }
+    if(candidates.empty() == false && current < candidates.top().first)
+    {
+      candidates.push(std::make_pair(current, e));
+      continue;
+    }
+    keep(e);
+  }
+
+  //the most similar instance that's kept stands in for each one that isn't
+  for(size_t e=0; e<numElements; e++)
+  {
+    if(kept[e] == false)
+    {
+      const std::vector<size_t> &others = keptInSlot[variants[e].m_slot];
+      size_t closest = others[0];
+      for(auto other : others)
+      {
+        if(difference(e, other) < difference(e, closest))
+        {
+          closest = other;
+        }
+      }
+      m_instanceCache.m_elements[closest].m_weight += m_instanceCache.m_elements[e].m_weight;
+    }
+  }
+  size_t e = 0;
+  m_instanceCache.eraseIf([&](Instance &, size_t, size_t, size_t)
+  {
+    return kept[e++] == false;
+  });
+}
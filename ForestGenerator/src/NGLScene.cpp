@@ -77,6 +77,9 @@ void NGLScene::initializeGL()
   glEnable(GL_DEPTH_TEST);
   // enable multisampling for smoother drawing
   glEnable(GL_MULTISAMPLE);
+  // line strip geometry separates its strips with RESTART_INDEX, no other index buffer uses that value
+  glEnable(GL_PRIMITIVE_RESTART);
+  glPrimitiveRestartIndex(RESTART_INDEX);
   // Now we will create a basic camera from the graphics library using the currently selected camera
   m_view=ngl::lookAt(m_currentCamera->m_from, m_currentCamera->m_to, m_currentCamera->m_up);
   // set the shape using FOV 45 Aspect Ratio based on Width and Height
@@ -99,18 +102,18 @@ void NGLScene::initializeGL()
   //set up LSystem VAOs:
   for(size_t i=0; i<m_numTreeTabs; i++)
   {
-    buildLineVAO(m_LSystems[i].m_vertices, m_LSystems[i].m_indices, m_LSystemVAOs[i]);
+    buildLSystemVAO(m_LSystems[i], m_LSystemVAOs[i]);
   }
 }
 
 //------------------------------------------------------------------------------------------------------------------------
 
-void NGLScene::buildLineVAO(std::vector<ngl::Vec3> &_vertices, std::vector<GLshort> &_indices,
-                            std::unique_ptr<ngl::AbstractVAO> &_vao)
+void NGLScene::buildLineVAO(std::vector<ngl::Vec3> &_vertices, std::vector<GLuint> &_indices,
+                            std::unique_ptr<ngl::AbstractVAO> &_vao, GLenum _mode)
 {
-  // create a vao using GL_LINES
+  // create a vao using GL_LINES (or GL_TRIANGLES for tube meshes)
   //ngl::VAOFactory::registerVAOCreator("instanceCacheVAO",ngl::InstanceCacheVAO::create);
-  _vao=ngl::VAOFactory::createVAO(ngl::simpleIndexVAO,GL_LINES);
+  _vao=ngl::VAOFactory::createVAO(ngl::simpleIndexVAO,_mode);
   _vao->bind();
 
   // set our data for the VAO
@@ -119,13 +122,29 @@ void NGLScene::buildLineVAO(std::vector<ngl::Vec3> &_vertices, std::vector<GLsho
                                                   _vertices[0].m_x,
                                                   uint(_indices.size()),
                                                   &_indices[0],
-                                                  GL_UNSIGNED_SHORT));
+                                                  GL_UNSIGNED_INT));
   // data is 12 bytes apart (=sizeof(Vec3))
   _vao->setVertexAttributePointer(0,3,GL_FLOAT,12,0);
   _vao->setNumIndices(_indices.size());
   _vao->unbind();
 }
 
+void NGLScene::buildLSystemVAO(LSystem &_LSystem, std::unique_ptr<ngl::AbstractVAO> &_vao)
+{
+  if(_LSystem.m_tubeMode)
+  {
+    buildLineVAO(_LSystem.m_tubeVertices, _LSystem.m_tubeIndices, _vao, GL_TRIANGLES);
+  }
+  else if(_LSystem.m_stripMode)
+  {
+    buildLineVAO(_LSystem.m_vertices, _LSystem.m_stripIndices, _vao, GL_LINE_STRIP);
+  }
+  else
+  {
+    buildLineVAO(_LSystem.m_vertices, _LSystem.m_indices, _vao);
+  }
+}
+
 //------------------------------------------------------------------------------------------------------------------------
 
 void NGLScene::buildInstanceCacheVAO(LSystem &_treeType, Instance &_instance, std::unique_ptr<ngl::AbstractVAO> &_vao)
@@ -140,7 +159,7 @@ void NGLScene::buildInstanceCacheVAO(LSystem &_treeType, Instance &_instance, st
                                                   _treeType.m_heroVertices[0].m_x,
                                                   uint(_instance.m_instanceEnd-_instance.m_instanceStart),
                                                   &_treeType.m_heroIndices[_instance.m_instanceStart],
-                                                  GL_UNSIGNED_SHORT));
+                                                  GL_UNSIGNED_INT));
   // data is 12 bytes apart (=sizeof(Vec3))
   _vao->setVertexAttributePointer(0,3,GL_FLOAT,12,0);
   _vao->setNumIndices(_instance.m_instanceEnd-_instance.m_instanceStart);
@@ -149,6 +168,61 @@ void NGLScene::buildInstanceCacheVAO(LSystem &_treeType, Instance &_instance, st
 
 //------------------------------------------------------------------------------------------------------------------------
 
+void NGLScene::buildLeafVAO(std::vector<ngl::Mat4> &_transforms, std::unique_ptr<ngl::AbstractVAO> &_vao,
+                            GLuint &_transformBuffer)
+{
+  //a unit card growing along the leaf direction, scaled by the leaf transform
+  std::vector<ngl::Vec3> cardVertices = {{-0.5f,0,0},{0.5f,0,0},{0.5f,1,0},{-0.5f,1,0}};
+  std::vector<GLuint> cardIndices = {0,1,2,0,2,3};
+  buildInstancedVAO(cardVertices, cardIndices, _transforms, _vao, _transformBuffer, GL_TRIANGLES);
+}
+
+void NGLScene::buildUniqueTreeVAO(Forest::UniqueTree &_uniqueTree, std::unique_ptr<ngl::AbstractVAO> &_vao,
+                                  GLuint &_transformBuffer)
+{
+  //drawn through the same instanced path and shader as the rest of the forest, as a single instance
+  std::vector<ngl::Mat4> transform = {m_forest.m_treeData[_uniqueTree.m_treeIndex].m_transform};
+  buildInstancedVAO(_uniqueTree.m_vertices, _uniqueTree.m_indices, transform, _vao, _transformBuffer,
+                    _uniqueTree.m_isTubeMesh ? GL_TRIANGLES : GL_LINES);
+}
+
+void NGLScene::buildInstancedVAO(std::vector<ngl::Vec3> &_vertices, std::vector<GLuint> &_indices,
+                                 std::vector<ngl::Mat4> &_transforms, std::unique_ptr<ngl::AbstractVAO> &_vao,
+                                 GLuint &_transformBuffer, GLenum _mode)
+{
+  _vao=ngl::VAOFactory::createVAO("instanceCacheVAO",_mode);
+  _vao->bind();
+  _vao->setData(ngl::InstanceCacheVAO::VertexData(
+                       sizeof(ngl::Vec3)*_vertices.size(),
+                       _vertices[0].m_x,
+                       uint(_indices.size()),
+                       &_indices[0],
+                       GL_UNSIGNED_INT,
+                       int(_transforms.size())));
+  _vao->setVertexAttributePointer(0,3,GL_FLOAT,12,0);
+  _vao->setNumIndices(_indices.size());
+
+  //these transforms don't change, so they only need uploading here rather than every frame
+  if(_transformBuffer == 0)
+  {
+    glGenBuffers(1, &_transformBuffer);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, _transformBuffer);
+  glBufferData(GL_ARRAY_BUFFER,
+               sizeof(ngl::Mat4)*static_cast<GLsizeiptr>(_transforms.size()),
+               _transforms.data(),
+               GL_STATIC_DRAW);
+  for(GLuint row=0; row<4; row++)
+  {
+    glEnableVertexAttribArray(1+row);
+    glVertexAttribPointer(1+row,4,GL_FLOAT,false,64,static_cast<ngl::Real *>(NULL)+4*row);
+    glVertexAttribDivisor(1+row,1);
+  }
+  _vao->unbind();
+}
+
+//------------------------------------------------------------------------------------------------------------------------
+
 NGLScene::buildTestVAO::buildTestVAO(LSystem &_treeType, CacheStructure<std::vector<ngl::Mat4> > &_outputCacheData) :
   m_treeType(_treeType), m_outputCacheData(_outputCacheData) {}
 
@@ -157,22 +231,60 @@ void NGLScene::buildTestVAO::operator ()(std::unique_ptr<ngl::AbstractVAO> &_vao
   Instance * instance = m_treeType.m_instanceCache.getElement(_id,_age,_innerIndex);
   size_t instanceCount = m_outputCacheData.getElement(_id,_age,_innerIndex)->size();
 
+  //in tube and strip mode the instance ranges are converted to the matching ranges of those index lists
+  GLenum mode = GL_LINES;
+  std::vector<ngl::Vec3> * vertices = &m_treeType.m_heroVertices;
+  std::vector<GLuint> * indices = &m_treeType.m_heroIndices;
+  size_t instanceStart = instance->m_instanceStart;
+  size_t instanceEnd = instance->m_instanceEnd;
+  if(m_treeType.m_tubeMode)
+  {
+    mode = GL_TRIANGLES;
+    vertices = &m_treeType.m_heroTubeVertices;
+    indices = &m_treeType.m_heroTubeIndices;
+    instanceStart = m_treeType.tubeIndex(instanceStart);
+    instanceEnd = m_treeType.tubeIndex(instanceEnd);
+  }
+  else if(m_treeType.m_stripMode)
+  {
+    mode = GL_LINE_STRIP;
+    indices = &m_treeType.m_heroStripIndices;
+    instanceStart = instance->m_stripStart;
+    instanceEnd = instance->m_stripEnd;
+  }
+
   // create a vao using GL_LINES
   //ngl::VAOFactory::registerVAOCreator("instanceCacheVAO",ngl::InstanceCacheVAO::create);
-  _vao=ngl::VAOFactory::createVAO("instanceCacheVAO",GL_LINES);
+  _vao=ngl::VAOFactory::createVAO("instanceCacheVAO",mode);
   _vao->bind();
 
   // set our data for the VAO
-  _vao->setData(ngl::InstanceCacheVAO::VertexData(
-                       sizeof(ngl::Vec3)*m_treeType.m_heroVertices.size(),
-                       m_treeType.m_heroVertices[0].m_x,
-                       uint(instance->m_instanceEnd-instance->m_instanceStart),
-                       &m_treeType.m_heroIndices[instance->m_instanceStart],
-                       GL_UNSIGNED_SHORT,
-                       int(instanceCount)));
-  // data is 12 bytes apart (=sizeof(Vec3))
-  _vao->setVertexAttributePointer(0,3,GL_FLOAT,12,0);
-  _vao->setNumIndices(instance->m_instanceEnd-instance->m_instanceStart);
+  if(m_treeType.m_heroQuantisedVertices.empty() == false && m_treeType.m_tubeMode == false)
+  {
+    //quantised vertices are uploaded as raw shorts, drawInstanceVAO folds the scale into the instance transforms
+    _vao->setData(ngl::InstanceCacheVAO::VertexData(
+                         sizeof(GLshort)*m_treeType.m_heroQuantisedVertices.size(),
+                         *reinterpret_cast<const GLfloat *>(m_treeType.m_heroQuantisedVertices.data()),
+                         uint(instanceEnd-instanceStart),
+                         &(*indices)[instanceStart],
+                         GL_UNSIGNED_INT,
+                         int(instanceCount)));
+    // data is 6 bytes apart (=3*sizeof(GLshort))
+    _vao->setVertexAttributePointer(0,3,GL_SHORT,6,0);
+  }
+  else
+  {
+    _vao->setData(ngl::InstanceCacheVAO::VertexData(
+                         sizeof(ngl::Vec3)*vertices->size(),
+                         (*vertices)[0].m_x,
+                         uint(instanceEnd-instanceStart),
+                         &(*indices)[instanceStart],
+                         GL_UNSIGNED_INT,
+                         int(instanceCount)));
+    // data is 12 bytes apart (=sizeof(Vec3))
+    _vao->setVertexAttributePointer(0,3,GL_FLOAT,12,0);
+  }
+  _vao->setNumIndices(instanceEnd-instanceStart);
   _vao->unbind();
 }
 
@@ -189,7 +301,7 @@ void NGLScene::buildTestVAO::operator ()(std::unique_ptr<ngl::AbstractVAO> &_vao
                        _treeType.m_heroVertices[0].m_x,
                        uint(_instance.m_instanceEnd-_instance.m_instanceStart),
                        &_treeType.m_heroIndices[_instance.m_instanceStart],
-                       GL_UNSIGNED_SHORT,
+                       GL_UNSIGNED_INT,
                        int(_instanceCount)));
   // data is 12 bytes apart (=sizeof(Vec3))
   _vao->setVertexAttributePointer(0,3,GL_FLOAT,12,0);
@@ -199,8 +311,9 @@ void NGLScene::buildTestVAO::operator ()(std::unique_ptr<ngl::AbstractVAO> &_vao
 
 //------------------------------------------------------------------------------------------------------------------------
 
-NGLScene::drawInstanceVAO::drawInstanceVAO(CacheStructure<std::vector<ngl::Mat4>> &_outputCacheData, CacheStructure<GLuint> &_bufferIds) :
-  m_outputCacheData(_outputCacheData), m_bufferIds(_bufferIds) {}
+NGLScene::drawInstanceVAO::drawInstanceVAO(LSystem &_treeType, CacheStructure<std::vector<ngl::Mat4>> &_outputCacheData,
+                                           CacheStructure<GLuint> &_bufferIds) :
+  m_treeType(_treeType), m_outputCacheData(_outputCacheData), m_bufferIds(_bufferIds) {}
 
 void NGLScene::drawInstanceVAO::operator ()(std::unique_ptr<ngl::AbstractVAO> &_vao, size_t &_id, size_t &_age, size_t &_innerIndex)
 {
@@ -209,13 +322,15 @@ void NGLScene::drawInstanceVAO::operator ()(std::unique_ptr<ngl::AbstractVAO> &_
   std::vector<ngl::Mat4> * transforms = m_outputCacheData.getElement(_id,_age,_innerIndex);
   GLuint * transformBuffer = m_bufferIds.getElement(_id,_age,_innerIndex);
 
-
-  glGenBuffers(1, transformBuffer);
+  if(*transformBuffer == 0)
+  {
+    glGenBuffers(1, transformBuffer);
+  }
   glBindBuffer(GL_ARRAY_BUFFER, *transformBuffer);
 
   glBufferData(GL_ARRAY_BUFFER,
                sizeof(ngl::Mat4)*static_cast<GLsizeiptr>(transforms->size()),
-               &transforms[0],
+               transforms->data(),
                GL_STATIC_DRAW);
 
   glEnableVertexAttribArray(1);
@@ -266,7 +381,7 @@ void NGLScene::paintGL()
 
   if(m_buildTreeVAO)
   {
-      buildLineVAO(m_currentLSystem->m_vertices, m_currentLSystem->m_indices, m_LSystemVAOs[m_treeTabNum]);
+      buildLSystemVAO(*m_currentLSystem, m_LSystemVAOs[m_treeTabNum]);
       m_buildTreeVAO = false;
   }
 
@@ -274,6 +389,7 @@ void NGLScene::paintGL()
   {
     m_instanceCacheVAOs.resize(m_numTreeTabs);
     m_bufferIds.resize(m_numTreeTabs);
+    m_instanceTransforms.resize(m_numTreeTabs);
     for(size_t t=0; t<m_forest.m_treeTypes.size(); t++)
     {
       LSystem &treeType = m_forest.m_treeTypes[t];
@@ -281,8 +397,38 @@ void NGLScene::paintGL()
       m_instanceCacheVAOs[t].resizeCache(instanceCache);
       m_bufferIds[t].resizeCache(instanceCache);
 
-      m_instanceCacheVAOs[t].forEachElement(buildTestVAO(treeType,
-                                                         m_forest.m_outputCache[t]));
+      //quantised hero vertices need their dequantisation folded into each transform. Every instance is
+      //independent, so they're prepared on all cores, leaving only the GL calls on this thread
+      CacheStructure<std::vector<ngl::Mat4>> &outputCache = m_forest.m_outputCache[t];
+      bool dequantise = treeType.m_heroQuantisedVertices.empty() == false && treeType.m_tubeMode == false;
+      m_instanceTransforms[t].resizeCache(instanceCache);
+      m_instanceTransforms[t].forEachElement(ExecutionPolicy::Parallel,
+                                             [&](std::vector<ngl::Mat4> &_transforms, size_t &_id, size_t &_age,
+                                                 size_t &_innerIndex)
+      {
+        _transforms = *outputCache.getElement(_id,_age,_innerIndex);
+        if(dequantise)
+        {
+          for(auto &transform : _transforms)
+          {
+            transform = treeType.dequantiseTransform(transform);
+          }
+        }
+      });
+
+      m_instanceCacheVAOs[t].forEachElement(buildTestVAO(treeType, m_instanceTransforms[t]));
+    }
+    m_leafVAOs.resize(m_forest.m_leafOutput.size());
+    m_leafBufferIds.resize(m_forest.m_leafOutput.size(), 0);
+    for(size_t t=0; t<m_forest.m_leafOutput.size(); t++)
+    {
+      buildLeafVAO(m_forest.m_leafOutput[t], m_leafVAOs[t], m_leafBufferIds[t]);
+    }
+    m_uniqueTreeVAOs.resize(m_forest.m_uniqueTrees.size());
+    m_uniqueTreeBufferIds.resize(m_forest.m_uniqueTrees.size(), 0);
+    for(size_t i=0; i<m_forest.m_uniqueTrees.size(); i++)
+    {
+      buildUniqueTreeVAO(m_forest.m_uniqueTrees[i], m_uniqueTreeVAOs[i], m_uniqueTreeBufferIds[i]);
     }
     m_buildInstanceVAO = false;
   }
@@ -308,9 +454,26 @@ void NGLScene::paintGL()
 
       for(size_t t=0; t<m_numTreeTabs; t++)
       {
-        m_instanceCacheVAOs[t].forEachElement(drawInstanceVAO(m_forest.m_outputCache[t],
+        m_instanceCacheVAOs[t].forEachElement(drawInstanceVAO(m_forest.m_treeTypes[t],
+                                                              m_instanceTransforms[t],
                                                               m_bufferIds[t]));
       }
+      //hybrid mode trees with their own geometry, drawn alongside the instanced ones
+      for(size_t i=0; i<m_forest.m_uniqueTrees.size() && i<m_uniqueTreeVAOs.size(); i++)
+      {
+        m_uniqueTreeVAOs[i]->bind();
+        m_uniqueTreeVAOs[i]->draw();
+        m_uniqueTreeVAOs[i]->unbind();
+      }
+      for(size_t t=0; t<m_leafVAOs.size(); t++)
+      {
+        if(m_forest.m_leafOutput[t].empty() == false)
+        {
+          m_leafVAOs[t]->bind();
+          m_leafVAOs[t]->draw();
+          m_leafVAOs[t]->unbind();
+        }
+      }
       break;
     }
 
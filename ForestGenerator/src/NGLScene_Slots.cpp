@@ -121,34 +121,34 @@ void NGLScene::setAxiom(QString _axiom)
 
 void NGLScene::setRule1(QString _rule)
 {
-  m_currentLSystem->m_ruleArray[0]=_rule.toStdString();
+  m_currentLSystem->setRule(0,_rule.toStdString());
 }
 
 void NGLScene::setRule2(QString _rule)
 {
-  m_currentLSystem->m_ruleArray[1]=_rule.toStdString();
+  m_currentLSystem->setRule(1,_rule.toStdString());
 }
 
 void NGLScene::setRule3(QString _rule)
 {
-  m_currentLSystem->m_ruleArray[2]=_rule.toStdString();
+  m_currentLSystem->setRule(2,_rule.toStdString());
 }
 void NGLScene::setRule4(QString _rule)
 {
-  m_currentLSystem->m_ruleArray[3]=_rule.toStdString();
+  m_currentLSystem->setRule(3,_rule.toStdString());
 }
 
 void NGLScene::setRule5(QString _rule)
 {
-  m_currentLSystem->m_ruleArray[4]=_rule.toStdString();
+  m_currentLSystem->setRule(4,_rule.toStdString());
 }
 
 void NGLScene::setRule6(QString _rule)
 {
-  m_currentLSystem->m_ruleArray[5]=_rule.toStdString();
+  m_currentLSystem->setRule(5,_rule.toStdString());
 }
 
 void NGLScene::setRule7(QString _rule)
 {
-  m_currentLSystem->m_ruleArray[6]=_rule.toStdString();
+  m_currentLSystem->setRule(6,_rule.toStdString());
 }
@@ -98,7 +98,7 @@ void print(std::vector<float> _vec)
     print(x);
   }
 }
-void print(std::vector<GLshort> _vec)
+void print(std::vector<GLuint> _vec)
 {
   for(auto x : _vec)
   {
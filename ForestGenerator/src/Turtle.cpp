@@ -0,0 +1,55 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file Turtle.cpp
+/// @brief implementation file for Turtle struct and RotationCache class
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <math.h>
+#include "Turtle.h"
+
+Turtle::Turtle(float _stepSize, float _angle, float _width, GLuint _lastIndex) :
+  m_stepSize(_stepSize), m_angle(_angle), m_width(_width), m_lastIndex(_lastIndex) {}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+//since m_right and m_dir are orthonormal, rotating one around the other reduces to
+//v*cos + (axis x v)*sin, and axis x v is just +/- the third axis of the frame
+
+void Turtle::roll(float _sin, float _cos)
+{
+  ngl::Vec3 k = m_right.cross(m_dir);
+  m_right = _cos*m_right - _sin*k;
+}
+
+void Turtle::pitch(float _sin, float _cos)
+{
+  ngl::Vec3 k = m_right.cross(m_dir);
+  m_dir = _cos*m_dir + _sin*k;
+}
+
+ngl::Mat4 Turtle::transform() const
+{
+  ngl::Vec3 k = m_right.cross(m_dir);
+  return ngl::Mat4(m_right.m_x,      m_right.m_y,      m_right.m_z,      0,
+                   m_dir.m_x,        m_dir.m_y,        m_dir.m_z,        0,
+                   k.m_x,            k.m_y,            k.m_z,            0,
+                   m_lastVertex.m_x, m_lastVertex.m_y, m_lastVertex.m_z, 1);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void RotationCache::getSinCos(float _angle, float &_sin, float &_cos)
+{
+  if(_angle != m_lastAngle)
+  {
+    auto it = m_cache.find(_angle);
+    if(it == m_cache.end())
+    {
+      float radians = _angle*float(M_PI)/180.0f;
+      it = m_cache.emplace(_angle, std::make_pair(sinf(radians), cosf(radians))).first;
+    }
+    m_lastAngle = _angle;
+    m_lastSinCos = it->second;
+  }
+  _sin = m_lastSinCos.first;
+  _cos = m_lastSinCos.second;
+}
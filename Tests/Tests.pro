@@ -12,7 +12,19 @@ SOURCES += main.cpp \
             ../ForestGenerator/src/LSystem.cpp \
             ../ForestGenerator/src/LSystem_createGeometry.cpp \
             ../ForestGenerator/src/LSystem_ForestMode.cpp \
-            ../ForestGenerator/src/Instance.cpp
+            ../ForestGenerator/src/LSystem_TubeMesh.cpp \
+            ../ForestGenerator/src/LSystem_Simplify.cpp \
+            ../ForestGenerator/src/LSystem_LineStrips.cpp \
+            ../ForestGenerator/src/LSystem_Quantise.cpp \
+            ../ForestGenerator/src/LSystem_CacheFile.cpp \
+            ../ForestGenerator/src/LSystem_Synthesis.cpp \
+            ../ForestGenerator/src/LSystem_Variety.cpp \
+            ../ForestGenerator/src/Instance.cpp \
+            ../ForestGenerator/src/Forest.cpp \
+            ../ForestGenerator/src/Forest_Tuning.cpp \
+            ../ForestGenerator/src/BoundingBox.cpp \
+            ../ForestGenerator/src/Turtle.cpp \
+            ../ForestGenerator/src/GeometrySink.cpp
 
 NGLPATH=$$(NGLDIR)
 isEmpty(NGLPATH){ # note brace must be here
@@ -1,5 +1,11 @@
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <set>
 #include <gtest/gtest.h>
 #include "LSystem.h"
+#include "Turtle.h"
+#include "Forest.h"
 
 
 int main(int argc, char *argv[])
@@ -139,3 +145,945 @@ TEST(LSystem, addInstancingCommands_nestedBranches)
   EXPECT_EQ(L.m_branches[2],"B");
   EXPECT_EQ(L.m_branches[3],"C[FFF]");
 }
+
+TEST(LSystem, breakDownRules_largeGrammar)
+{
+  //more rules than the old fixed-size rule array could hold, with repeated LHSs
+  std::vector<std::string> rules = {};
+  for(int i=0; i<26; i++)
+  {
+    std::string lhs(1, char('A'+i));
+    rules.push_back(lhs+"=F"+lhs+":1");
+    rules.push_back(lhs+"=FF"+lhs+":3");
+  }
+  LSystem L("A",rules,2,0.9f,30,0.9f,0);
+
+  EXPECT_EQ(L.m_ruleArray.size(),52);
+  EXPECT_EQ(L.m_rules.size(),26);
+  EXPECT_EQ(L.m_rules[25].m_LHS,"Z");
+  EXPECT_EQ(L.m_rules[25].m_RHS,std::vector<std::string>({"FZ","FFZ"}));
+  EXPECT_FLOAT_EQ(L.m_rules[25].m_prob[1],0.75f);
+  EXPECT_EQ(L.m_ruleIndices.at("Z"),25);
+
+  L.setRule(60,"A=B");
+  EXPECT_EQ(L.m_ruleArray.size(),61);
+  EXPECT_EQ(L.m_ruleArray[60],"A=B");
+}
+
+TEST(Turtle, rotations)
+{
+  Turtle turtle(1,30,1,0);
+  RotationCache rotationCache;
+  float sinAngle, cosAngle;
+
+  rotationCache.getSinCos(90, sinAngle, cosAngle);
+  turtle.pitch(sinAngle, cosAngle);
+  EXPECT_EQ(turtle.m_dir,ngl::Vec3(0,0,1));
+  EXPECT_EQ(turtle.m_right,ngl::Vec3(1,0,0));
+
+  //rolling forwards then backwards by the same angle should give back the same frame
+  rotationCache.getSinCos(33, sinAngle, cosAngle);
+  turtle.roll(sinAngle, cosAngle);
+  turtle.roll(-sinAngle, cosAngle);
+  EXPECT_EQ(turtle.m_dir,ngl::Vec3(0,0,1));
+  EXPECT_EQ(turtle.m_right,ngl::Vec3(1,0,0));
+
+  //frame should stay orthonormal
+  turtle.roll(sinAngle, cosAngle);
+  turtle.pitch(sinAngle, cosAngle);
+  EXPECT_FLOAT_EQ(turtle.m_dir.length(),1);
+  EXPECT_FLOAT_EQ(turtle.m_right.length(),1);
+  EXPECT_NEAR(turtle.m_dir.dot(turtle.m_right),0,1e-6);
+}
+
+TEST(LSystem, createGeometry_largeIndices)
+{
+  //more vertices than fit in a 16-bit index
+  std::string axiom(40000,'F');
+  LSystem L(axiom,{},1,0.9f,30,0.9f,0);
+
+  EXPECT_EQ(L.m_vertices.size(),40001);
+  EXPECT_EQ(L.m_indices.size(),80000);
+  EXPECT_EQ(L.m_indices[79998],39999);
+  EXPECT_EQ(L.m_indices[79999],40000);
+}
+
+TEST(LSystem, createGeometryParallel)
+{
+  std::string axiom = "///A";
+  std::vector<std::string> rules = {"A=F&[[A]^A]^F^[^FA]&A","F=FF"};
+  LSystem L(axiom,rules,1,0.9f,25,0.9f,6);
+  L.m_numThreads = 1;
+  L.createGeometry();
+  std::vector<ngl::Vec3> serialVertices = L.m_vertices;
+  std::vector<GLuint> serialIndices = L.m_indices;
+
+  //splitting at the top-level branches should give exactly the same geometry
+  L.m_numThreads = 4;
+  L.m_minParallelStringSize = 0;
+  std::vector<ngl::Vec3> vertices = {};
+  std::vector<GLuint> indices = {};
+  std::vector<float> widths = {};
+  BufferSink sink(vertices, indices, widths);
+  EXPECT_TRUE(L.createGeometryParallel(L.generateTreeString(), sink));
+  EXPECT_EQ(vertices,serialVertices);
+  EXPECT_EQ(indices,serialIndices);
+
+  //strings with instancing commands can't be split
+  EXPECT_FALSE(L.createGeometryParallel("F[F]{(1,0)F}", sink));
+}
+
+TEST(LSystem, createTubeMesh)
+{
+  LSystem L("F!(0.5)F",{},2,0.9f,30,0.9f,0);
+  L.m_width = 1;
+  L.m_tubeMode = true;
+  L.m_tubeSides = 6;
+  L.createGeometry();
+
+  EXPECT_EQ(L.m_widths,std::vector<float>({1,1,0.5f}));
+  EXPECT_EQ(L.m_tubeVertices.size(),2*2*6);
+  EXPECT_EQ(L.m_tubeIndices.size(),L.tubeIndex(L.m_indices.size()));
+
+  //each ring should sit around its vertex at the width of that vertex
+  for(size_t k=0; k<6; k++)
+  {
+    ngl::Vec3 firstRing = L.m_tubeVertices[k]-L.m_vertices[0];
+    ngl::Vec3 lastRing = L.m_tubeVertices[18+k]-L.m_vertices[2];
+    EXPECT_FLOAT_EQ(firstRing.length(),1);
+    EXPECT_FLOAT_EQ(lastRing.length(),0.5f);
+    EXPECT_NEAR(firstRing.m_y,0,1e-6);
+    EXPECT_NEAR(lastRing.m_y,0,1e-6);
+  }
+  //second segment's triangles start after the first segment's
+  EXPECT_EQ(L.m_tubeIndices[L.tubeIndex(2)],12);
+}
+
+TEST(LSystem, geometrySinks)
+{
+  LSystem L("F[&F]F",{},1,1,90,1,0);
+  L.createGeometry();
+
+  BoundsSink bounds;
+  L.createGeometry(bounds);
+  EXPECT_EQ(bounds.m_numVertices,L.m_vertices.size());
+  EXPECT_EQ(bounds.m_numSegments,L.m_indices.size()/2);
+  EXPECT_NEAR(bounds.m_max.m_z,1,1e-6);
+  EXPECT_NEAR(bounds.m_max.m_y,2,1e-6);
+
+  std::ostringstream stream;
+  OBJSink obj(stream);
+  L.m_axiom = "FF";
+  L.createGeometry(obj);
+  EXPECT_EQ(stream.str(),"v 0 0 0\nv 0 1 0\nl 1 2\nv 0 2 0\nl 2 3\n");
+}
+
+TEST(LSystem, simplifyGeometry)
+{
+  LSystem L("FFF[&F]FF",{},1,1,90,1,0);
+  L.m_simplify = true;
+  L.createGeometry();
+
+  //the straight runs collapse, but the branch point stays
+  EXPECT_EQ(L.m_vertices.size(),4);
+  EXPECT_EQ(L.m_indices,std::vector<GLuint>({0,1,1,2,1,3}));
+  EXPECT_NEAR(L.m_vertices[1].m_y,3,1e-5);
+  EXPECT_NEAR(L.m_vertices[3].m_y,5,1e-5);
+
+  //segments aren't merged across a boundary, and the boundary is moved to match
+  std::vector<ngl::Vec3> vertices = {{0,0,0},{0,1,0},{0,2,0},{0,3,0},{0,4,0}};
+  std::vector<GLuint> indices = {0,1,1,2,2,3,3,4};
+  std::vector<float> widths(5,1);
+  size_t boundary = 4;
+  L.simplifyGeometry(vertices,indices,widths,{&boundary});
+  EXPECT_EQ(indices,std::vector<GLuint>({0,1,1,2}));
+  EXPECT_EQ(vertices.size(),3);
+  EXPECT_EQ(boundary,2);
+}
+
+TEST(LSystem, createLineStrips)
+{
+  LSystem L("FF[&F]F",{},1,1,90,1,0);
+  L.m_stripMode = true;
+  L.createGeometry();
+
+  //the branch starts a new strip, and the trunk after it can't continue from the branch tip
+  EXPECT_EQ(L.m_indices,std::vector<GLuint>({0,1,1,2,2,3,2,4}));
+  EXPECT_EQ(L.m_stripIndices,std::vector<GLuint>({0,1,2,3,RESTART_INDEX,2,4}));
+
+  //boundaries always start a new strip
+  std::vector<GLuint> stripIndices = {};
+  std::vector<size_t> stripBoundaries = {};
+  L.createLineStrips({0,1,1,2,2,3},stripIndices,{2,6},stripBoundaries);
+  EXPECT_EQ(stripIndices,std::vector<GLuint>({0,1,RESTART_INDEX,1,2,3}));
+  EXPECT_EQ(stripBoundaries,std::vector<size_t>({3,6}));
+}
+
+TEST(LSystem, quantiseHeroVertices)
+{
+  LSystem L;
+  std::vector<ngl::Vec3> vertices = {{0,0,0},{1,2,0.5f},{-1,4,0.5f}};
+  L.m_heroVertices = vertices;
+  L.quantiseHeroVertices();
+
+  EXPECT_TRUE(L.m_heroVertices.empty());
+  EXPECT_EQ(L.m_heroQuantisedVertices.size(),9);
+  for(size_t i=0; i<vertices.size(); i++)
+  {
+    EXPECT_NEAR(L.heroVertex(i).m_x,vertices[i].m_x,1e-4);
+    EXPECT_NEAR(L.heroVertex(i).m_y,vertices[i].m_y,1e-4);
+    EXPECT_NEAR(L.heroVertex(i).m_z,vertices[i].m_z,1e-4);
+  }
+
+  //drawing the raw quantised values with the folded transform should match the original transform
+  ngl::Mat4 transform;
+  transform.rotateY(30);
+  transform.m_30 = 5;
+  ngl::Mat4 folded = L.dequantiseTransform(transform);
+  for(size_t i=0; i<vertices.size(); i++)
+  {
+    for(int col=0; col<3; col++)
+    {
+      float expected = transform.m_m[3][col];
+      float result = folded.m_m[3][col];
+      for(int row=0; row<3; row++)
+      {
+        expected += vertices[i][row]*transform.m_m[row][col];
+        result += L.m_heroQuantisedVertices[3*i+size_t(row)]*folded.m_m[row][col];
+      }
+      EXPECT_NEAR(result,expected,1e-3);
+    }
+  }
+}
+
+TEST(CacheStructure, flattenedStorage)
+{
+  CacheStructure<int> cache;
+  cache.resizeCache(2,1);
+  cache.pushBackElement(1,1,3);
+  cache.pushBackElement(0,0,0);
+  cache.pushBackElement(1,0,2);
+  cache.pushBackElement(0,0,1);
+  EXPECT_EQ(cache.numInstancesAt(0,0),2);
+  EXPECT_EQ(cache.numInstancesAt(0,1),0);
+  EXPECT_EQ(cache.numInstancesAt(1,1),1);
+  EXPECT_EQ(*cache.getLastElementAt(0,0),1);
+
+  //pushed elements wait to be merged into the sorted arrays all at once, and only the slots that have been pushed
+  //to are stored
+  EXPECT_EQ(cache.numSlots(),0);
+  EXPECT_EQ(cache.numElements(),4);
+  cache.mergePushedElements();
+  EXPECT_EQ(cache.numSlots(),3);
+  EXPECT_EQ(cache.m_slotKeys,std::vector<size_t>({0,2,3}));
+  EXPECT_EQ(cache.findSlot(0,1),cache.numSlots());
+  EXPECT_EQ(cache.slotId(cache.findSlot(1,0)),1);
+  EXPECT_EQ(cache.slotAge(cache.findSlot(1,0)),0);
+
+  //elements are kept in id then age order, whatever order they were pushed in
+  std::vector<int> visited = {};
+  cache.forEachElement([&](int &_element, size_t _id, size_t _age, size_t _innerIndex)
+  {
+    EXPECT_EQ(*cache.getElement(_id,_age,_innerIndex),_element);
+    visited.push_back(_element);
+  });
+  EXPECT_EQ(visited,std::vector<int>({0,1,2,3}));
+
+  //pushing more after a merge reads on from the merged elements of the same slot, and merging keeps them in order
+  cache.pushBackElement(0,0,4);
+  cache.pushBackElement(0,1,5);
+  EXPECT_EQ(cache.numInstancesAt(0,0),3);
+  EXPECT_EQ(*cache.getElement(0,0,1),1);
+  EXPECT_EQ(*cache.getElement(0,0,2),4);
+  cache.setElement(0,0,2,6);
+  EXPECT_EQ(*cache.getLastElementAt(0,0),6);
+  cache.mergePushedElements();
+  EXPECT_EQ(cache.m_elements,std::vector<int>({0,1,6,5,2,3}));
+  EXPECT_EQ(cache.m_offsets,std::vector<size_t>({0,3,4,5,6}));
+  cache.eraseIf([](int &_element, size_t, size_t, size_t) { return _element >= 5; });
+
+  //a cache of another type can be given the same shape, including move only types
+  CacheStructure<std::unique_ptr<int>> pointers;
+  pointers.resizeCache(cache);
+  EXPECT_EQ(pointers.numInstancesAt(0,0),2);
+  pointers.setElement(1,1,0,std::unique_ptr<int>(new int(3)));
+  EXPECT_EQ(**pointers.getElement(1,1,0),3);
+  EXPECT_EQ(*pointers.getElement(0,0,0),nullptr);
+
+  //slots left empty are dropped
+  cache.eraseIf([](int &_element, size_t, size_t, size_t) { return _element == 2; });
+  EXPECT_EQ(cache.numSlots(),2);
+  EXPECT_EQ(cache.numInstancesAt(1,0),0);
+  EXPECT_EQ(*cache.getElement(1,1,0),3);
+  EXPECT_EQ(cache.m_offsets,std::vector<size_t>({0,2,3}));
+}
+
+TEST(CacheStructure, executionPolicies)
+{
+  CacheStructure<int> cache;
+  cache.resizeCache(3,2);
+  for(int i=0; i<100; i++)
+  {
+    cache.pushBackElement(size_t(i%3), size_t(i%2), i);
+  }
+
+  //every element is visited once, with the same indices, whatever the policy
+  std::vector<int> visits(100,0);
+  cache.forEachElement(ExecutionPolicy::Parallel, [&](int &_element, size_t &_id, size_t &_age, size_t &_innerIndex)
+  {
+    EXPECT_EQ(*cache.getElement(_id,_age,_innerIndex),_element);
+    visits[size_t(_element)]++;
+  });
+  EXPECT_EQ(visits,std::vector<int>(100,1));
+
+  auto sum = [](int _a, int _b) { return _a+_b; };
+  auto value = [](int &_element, size_t, size_t, size_t) { return _element; };
+  EXPECT_EQ(cache.transformReduce(ExecutionPolicy::Sequential, 0, value, sum),4950);
+  EXPECT_EQ(cache.transformReduce(ExecutionPolicy::ParallelUnsequenced, 0, value, sum),4950);
+  EXPECT_EQ(cache.countIf(ExecutionPolicy::Parallel, [](int &, size_t _id, size_t, size_t) { return _id==0; }),34);
+
+  //bounds of a tree's cached instances
+  LSystem L("F",{},1,1,90,1,0);
+  L.m_instanceCache.resizeCache(3,1);
+  L.m_forestMode = true;
+  std::vector<ngl::Vec3> vertices = {};
+  std::vector<GLuint> indices = {};
+  std::vector<float> widths = {};
+  BufferSink sink(vertices, indices, widths);
+  L.interpretTreeString("F{(1,0)F}F{(2,0)FF}", sink);
+  BoundingBox bounds = L.m_instanceCache.transformReduce(ExecutionPolicy::Parallel, BoundingBox(),
+                         [](Instance &_instance, size_t, size_t, size_t) { return _instance.m_bounds; },
+                         [](BoundingBox _a, const BoundingBox &_b) { _a.expand(_b); return _a; });
+  EXPECT_NEAR(bounds.m_min.m_y,1,1e-6);
+  EXPECT_NEAR(bounds.m_max.m_y,5,1e-6);
+}
+
+TEST(Instance, inverseTransform)
+{
+  ngl::Mat4 transform;
+  transform.rotateY(30);
+  transform.m_30 = 1;
+  transform.m_31 = 2;
+  transform.m_32 = 3;
+  Instance instance(transform);
+  EXPECT_EQ(instance.m_inverseTransform*instance.m_transform,ngl::Mat4());
+  EXPECT_EQ(Instance().m_inverseTransform,ngl::Mat4());
+}
+
+TEST(Instance, arena)
+{
+  LSystem L("F",{},1,1,90,1,0);
+  L.m_instanceCache.resizeCache(3,1);
+  L.m_forestMode = true;
+  BufferSink sink(L.m_heroVertices, L.m_heroIndices, L.m_heroWidths);
+  //exit points are added to every open instance, but each instance's end up next to each other in the arena
+  L.interpretTreeString("{(0,0)F{(1,0)F<(2,1)F>~}<(2,1)F>~}", sink);
+  EXPECT_EQ(L.m_instanceArena.m_exitPoints.size(),3);
+  EXPECT_EQ(L.m_instanceArena.m_leaves.size(),3);
+  Instance * trunk = L.m_instanceCache.getElement(0,0,0);
+  auto exitPoints = L.m_instanceArena.exitPoints(*trunk);
+  ASSERT_EQ(exitPoints.size(),2);
+  for(auto &exitPoint : exitPoints)
+  {
+    EXPECT_EQ(exitPoint.m_exitId,2);
+    EXPECT_EQ(exitPoint.m_exitAge,1);
+  }
+  EXPECT_EQ(L.m_instanceArena.leaves(*trunk).size(),2);
+  EXPECT_EQ(L.m_instanceArena.exitPoints(*L.m_instanceCache.getElement(1,0,0)).size(),1);
+  EXPECT_TRUE(L.m_instanceArena.exitPoints(*L.m_instanceCache.getElement(2,1,0)).empty());
+
+  //removing an instance leaves its entries behind until the hero geometry is compacted
+  L.m_instanceCache.eraseIf([](Instance &, size_t _id, size_t, size_t) { return _id == 1; });
+  L.compactHeroGeometry();
+  EXPECT_EQ(L.m_instanceArena.m_exitPoints.size(),2);
+  EXPECT_EQ(L.m_instanceArena.m_leaves.size(),2);
+  EXPECT_EQ(L.m_instanceArena.exitPoints(*L.m_instanceCache.getElement(0,0,0)).size(),2);
+}
+
+TEST(LSystem, leaves)
+{
+  LSystem L("F~F~(2)",{},1,1,90,1,0);
+  L.createGeometry();
+
+  //leaves don't add any line geometry
+  EXPECT_EQ(L.m_vertices.size(),3);
+  ASSERT_EQ(L.m_leaves.size(),2);
+  EXPECT_NEAR(L.m_leaves[0].m_position.m_y,1,1e-6);
+  EXPECT_NEAR(L.m_leaves[1].m_position.m_y,2,1e-6);
+  EXPECT_FLOAT_EQ(L.m_leaves[0].m_size,L.m_leafSize);
+  EXPECT_FLOAT_EQ(L.m_leaves[1].m_size,2);
+  EXPECT_NEAR(L.m_leaves[1].transform().m_11,2,1e-6);
+
+  //in forest mode, leaves are stored relative to the instance they're in
+  L.m_instanceCache.resizeCache(2,1);
+  L.m_forestMode = true;
+  std::vector<ngl::Vec3> vertices = {};
+  std::vector<GLuint> indices = {};
+  std::vector<float> widths = {};
+  BufferSink sink(vertices, indices, widths);
+  L.interpretTreeString("F{(1,0)F~}", sink);
+  Instance * instance = L.m_instanceCache.getElement(1,0,0);
+  auto leaves = L.m_instanceArena.leaves(*instance);
+  ASSERT_EQ(leaves.size(),1);
+  EXPECT_NEAR(leaves[0].m_position.m_y,1,1e-6);
+  EXPECT_NEAR(leaves[0].m_dir.m_y,1,1e-6);
+}
+
+TEST(LSystem, instanceCacheFile)
+{
+  LSystem L("A",{"A=F[&F~A]/(90)[&FA]"},1,1,30,1,3);
+  L.m_useSeed = true;
+  L.m_seed = 1;
+  L.m_stripMode = true;
+  L.m_instanceCacheDirectory = ::testing::TempDir();
+  LSystem copy = L;
+  std::string fileName = L.instanceCacheFileName(2);
+  std::remove(fileName.c_str());
+  //removed however the test ends, including when an assertion returns early
+  struct RemoveFile
+  {
+    ~RemoveFile() { std::remove(m_fileName.c_str()); }
+    std::string m_fileName;
+  } removeFile = {fileName};
+
+  //the first fill generates the cache and saves it, the second loads it
+  L.fillInstanceCache(2);
+  copy.fillInstanceCache(2);
+  EXPECT_EQ(copy.m_axiom,L.m_axiom);
+  EXPECT_EQ(copy.m_heroIndices,L.m_heroIndices);
+  EXPECT_EQ(copy.m_heroStripIndices,L.m_heroStripIndices);
+  ASSERT_EQ(copy.m_heroVertices.size(),L.m_heroVertices.size());
+  for(size_t i=0; i<L.m_heroVertices.size(); i++)
+  {
+    EXPECT_EQ(copy.m_heroVertices[i],L.m_heroVertices[i]);
+  }
+  ASSERT_EQ(copy.m_instanceCache.numElements(),L.m_instanceCache.numElements());
+  EXPECT_EQ(copy.m_instanceCache.m_offsets,L.m_instanceCache.m_offsets);
+  size_t numLeaves = 0;
+  L.m_instanceCache.forEachElement([&](Instance &_instance, size_t _id, size_t _age, size_t _innerIndex)
+  {
+    Instance * loaded = copy.m_instanceCache.getElement(_id,_age,_innerIndex);
+    EXPECT_EQ(loaded->m_transform,_instance.m_transform);
+    EXPECT_EQ(loaded->m_instanceStart,_instance.m_instanceStart);
+    EXPECT_EQ(loaded->m_instanceEnd,_instance.m_instanceEnd);
+    EXPECT_EQ(loaded->m_stripEnd,_instance.m_stripEnd);
+    EXPECT_EQ(loaded->m_bounds.m_max,_instance.m_bounds.m_max);
+    auto exitPoints = L.m_instanceArena.exitPoints(_instance);
+    auto loadedExitPoints = copy.m_instanceArena.exitPoints(*loaded);
+    ASSERT_EQ(loadedExitPoints.size(),exitPoints.size());
+    for(size_t e=0; e<exitPoints.size(); e++)
+    {
+      EXPECT_EQ(loadedExitPoints[e].m_exitId,exitPoints[e].m_exitId);
+      EXPECT_EQ(loadedExitPoints[e].m_exitTransform,exitPoints[e].m_exitTransform);
+    }
+    auto leaves = L.m_instanceArena.leaves(_instance);
+    auto loadedLeaves = copy.m_instanceArena.leaves(*loaded);
+    ASSERT_EQ(loadedLeaves.size(),leaves.size());
+    for(size_t l=0; l<leaves.size(); l++)
+    {
+      EXPECT_EQ(loadedLeaves[l].transform(),leaves[l].transform());
+    }
+    numLeaves += leaves.size();
+  });
+  EXPECT_GT(numLeaves,0);
+
+  //a different seed gets a different file, and a file for another tree is rejected
+  copy.m_seed = 2;
+  EXPECT_NE(copy.instanceCacheFileName(2),fileName);
+  EXPECT_FALSE(copy.loadInstanceCache(fileName,copy.instanceCacheKey(2)));
+
+  //files with ranges or indices outside their buffers are rejected without touching the tree
+  uint64_t key = L.instanceCacheKey(2);
+  std::vector<std::function<void(LSystem &)>> corruptions = {
+    [](LSystem &_L) { _L.m_heroIndices[0] = GLuint(_L.m_heroVertices.size()); },
+    [](LSystem &_L) { _L.m_heroStripIndices[0] = GLuint(_L.m_heroVertices.size()); },
+    [](LSystem &_L) { _L.m_instanceCache.m_elements[0].m_instanceEnd = _L.m_heroIndices.size()+1; },
+    [](LSystem &_L) { _L.m_instanceCache.m_elements[0].m_stripStart = _L.m_instanceCache.m_elements[0].m_stripEnd+1; },
+    [](LSystem &_L) { _L.m_instanceArena.m_exitPoints[0].m_exitAge = _L.m_instanceCache.numAges(); }
+  };
+  for(auto &corrupt : corruptions)
+  {
+    LSystem corrupted = L;
+    corrupt(corrupted);
+    ASSERT_TRUE(corrupted.saveInstanceCache(fileName,key));
+    LSystem loaded = L;
+    EXPECT_FALSE(loaded.loadInstanceCache(fileName,key));
+    EXPECT_EQ(loaded.m_heroIndices,L.m_heroIndices);
+  }
+}
+
+TEST(LSystem, bounds)
+{
+  LSystem L("F[&F]/F",{},1,1,90,1,0);
+  L.createGeometry();
+  EXPECT_NEAR(L.m_bounds.m_min.m_y,0,1e-6);
+  EXPECT_NEAR(L.m_bounds.m_max.m_y,2,1e-6);
+  EXPECT_NEAR(L.m_bounds.m_max.m_z,1,1e-6);
+  EXPECT_NEAR(L.m_bounds.radius(),0.5f*sqrtf(5),1e-5);
+
+  //instances get the bounds of their own range, which also count towards any enclosing instance
+  L.m_instanceCache.resizeCache(3,1);
+  L.m_forestMode = true;
+  std::vector<ngl::Vec3> vertices = {};
+  std::vector<GLuint> indices = {};
+  std::vector<float> widths = {};
+  BufferSink sink(vertices, indices, widths);
+  L.interpretTreeString("F{(1,0)F[&{(2,0)F}]}F", sink);
+  Instance * outer = L.m_instanceCache.getElement(1,0,0);
+  Instance * inner = L.m_instanceCache.getElement(2,0,0);
+  EXPECT_NEAR(inner->m_bounds.m_min.m_y,2,1e-6);
+  EXPECT_NEAR(inner->m_bounds.m_max.m_z,1,1e-6);
+  EXPECT_NEAR(outer->m_bounds.m_min.m_y,1,1e-6);
+  EXPECT_NEAR(outer->m_bounds.m_max.m_y,2,1e-6);
+  EXPECT_NEAR(outer->m_bounds.m_max.m_z,1,1e-6);
+
+  //moving a box by a transform keeps it around the moved points
+  ngl::Mat4 transform;
+  transform.rotateY(90);
+  transform.m_30 = 3;
+  BoundingBox moved = inner->m_bounds.transformed(transform);
+  EXPECT_NEAR(moved.m_min.m_x,3,1e-5);
+  EXPECT_NEAR(moved.m_max.m_x,4,1e-5);
+  EXPECT_NEAR(moved.m_min.m_y,2,1e-5);
+}
+
+TEST(LSystem, createHeroTrees)
+{
+  //on one thread the hero trees share one cache, so a '<' branch is only drawn by the first tree to reach it. Made on
+  //several threads, the trees have to come out the same, and so do the forests built from them
+  std::vector<std::string> rules = {"A=F[&FA]/(90)[&FA]F[^FA]"};
+  LSystem full("A",rules,1,1,30,1,5);
+  full.createGeometry();
+  LSystem serial("A",rules,1,1,30,1,5);
+  serial.m_useSeed = true;
+  serial.m_seed = 5;
+  LSystem parallel = serial;
+  serial.m_numThreads = 1;
+  parallel.m_numThreads = 4;
+  serial.fillInstanceCache(10);
+  parallel.fillInstanceCache(10);
+  EXPECT_GT(serial.m_heroIndices.size(),0);
+  EXPECT_EQ(parallel.m_heroIndices,serial.m_heroIndices);
+  EXPECT_EQ(parallel.m_instanceCache.m_offsets,serial.m_instanceCache.m_offsets);
+  ASSERT_EQ(parallel.m_heroVertices.size(),serial.m_heroVertices.size());
+  for(size_t i=0; i<serial.m_heroVertices.size(); i++)
+  {
+    EXPECT_EQ(parallel.m_heroVertices[i],serial.m_heroVertices[i]);
+  }
+
+  //the indices drawn for each tree of the same forest, built from either cache
+  auto drawnIndices = [](const LSystem &_treeType)
+  {
+    Forest forest;
+    forest.m_treeTypes = {_treeType};
+    forest.m_width = 50;
+    forest.m_length = 50;
+    forest.m_numTrees = 50;
+    forest.m_numHeroTrees = 10;
+    forest.m_useSeed = true;
+    forest.scatterForest();
+    forest.resizeOutputCache();
+    std::vector<size_t> result = {};
+    for(auto &tree : forest.m_treeData)
+    {
+      size_t numOutput = forest.m_output.size();
+      forest.createTree(tree.m_type,tree.m_transform,0,0,tree.m_bounds);
+      size_t numIndices = 0;
+      for(size_t o=numOutput; o<forest.m_output.size(); o++)
+      {
+        const Forest::OutputData &output = forest.m_output[o];
+        const Instance *instance = forest.m_treeTypes[0].m_instanceCache.getElement(output.m_id,output.m_age,
+                                                                                   output.m_innerIndex);
+        numIndices += instance->m_instanceEnd-instance->m_instanceStart;
+      }
+      result.push_back(numIndices);
+    }
+    return result;
+  };
+  std::vector<size_t> serialIndices = drawnIndices(serial);
+  EXPECT_EQ(drawnIndices(parallel),serialIndices);
+  //only instances from the first tree to reach a '<' branch draw it twice, so on average a forest tree is drawn with
+  //about as many indices as a full tree
+  size_t totalIndices = 0;
+  for(auto numIndices : serialIndices)
+  {
+    totalIndices += numIndices;
+  }
+  EXPECT_LT(totalIndices/serialIndices.size(),full.m_indices.size()*3/2);
+}
+
+TEST(LSystem, deduplicateInstances)
+{
+  LSystem L("F",{},1,1,90,1,0);
+  L.m_instanceCache.resizeCache(2,1);
+  L.m_forestMode = true;
+  BufferSink sink(L.m_heroVertices, L.m_heroIndices, L.m_heroWidths);
+  //the first two instances are the same apart from where they are, the third is longer
+  L.interpretTreeString("F{(1,0)F}/{(1,0)F}F{(1,0)FF}", sink);
+  ASSERT_EQ(L.m_instanceCache.numInstancesAt(1,0),3);
+
+  L.deduplicateInstances();
+  ASSERT_EQ(L.m_instanceCache.numInstancesAt(1,0),2);
+  Instance * first = L.m_instanceCache.getElement(1,0,0);
+  Instance * second = L.m_instanceCache.getElement(1,0,1);
+  EXPECT_EQ(first->m_weight,2);
+  EXPECT_EQ(second->m_weight,1);
+  EXPECT_EQ(second->m_instanceEnd-second->m_instanceStart,4);
+
+  //the merged instance's geometry is no longer needed
+  L.compactHeroGeometry();
+  EXPECT_EQ(L.m_heroIndices.size(),6);
+}
+
+TEST(LSystem, fillMissingInstances)
+{
+  LSystem L("A",{"A=F[&FA]/(90)[&FA]"},1,1,30,1,3);
+  L.m_useSeed = true;
+  L.m_seed = 1;
+
+  //without any hero trees nothing reaches the cache on its own
+  LSystem withoutFilling = L;
+  withoutFilling.m_fillMissingInstances = false;
+  withoutFilling.fillInstanceCache(0);
+  EXPECT_EQ(withoutFilling.m_instanceCache.numElements(),0);
+
+  //but every slot an instance leads to can be synthesised
+  L.fillInstanceCache(0);
+  ASSERT_GT(L.m_instanceCache.numInstancesAt(0,0),0);
+  size_t numExitPoints = 0;
+  L.m_instanceCache.forEachElement([&](Instance &_instance, size_t, size_t, size_t)
+  {
+    for(auto &exitPoint : L.m_instanceArena.exitPoints(_instance))
+    {
+      EXPECT_GT(L.m_instanceCache.numInstancesAt(exitPoint.m_exitId,exitPoint.m_exitAge),0);
+      numExitPoints++;
+    }
+    EXPECT_LE(_instance.m_instanceEnd,L.m_heroIndices.size());
+  });
+  EXPECT_GT(numExitPoints,0);
+
+  //a slot emptied after the cache is finished gets new geometry, whether or not the hero vertices are quantised
+  for(bool quantise : {false, true})
+  {
+    LSystem Q("A",{"A=F[&FA]/(90)[&FA]"},1,1,30,1,3);
+    Q.m_useSeed = true;
+    Q.m_seed = 1;
+    Q.m_quantiseHeroVertices = quantise;
+    Q.fillInstanceCache(0);
+    auto numVertices = [&]()
+    {
+      return quantise ? Q.m_heroQuantisedVertices.size()/3 : Q.m_heroVertices.size();
+    };
+    EXPECT_EQ(Q.m_heroQuantisedVertices.empty(),quantise == false);
+    size_t numVerticesBefore = numVertices();
+    Instance::ExitPoint exitPoint = Q.m_instanceArena.exitPoints(*Q.m_instanceCache.getElement(0,0,0))[0];
+    Q.m_instanceCache.eraseIf([&](Instance &, size_t _id, size_t _age, size_t)
+    {
+      return _id == exitPoint.m_exitId && _age == exitPoint.m_exitAge;
+    });
+    ASSERT_EQ(Q.m_instanceCache.numInstancesAt(exitPoint.m_exitId,exitPoint.m_exitAge),0);
+    ASSERT_TRUE(Q.addMissingInstance(exitPoint.m_exitId,exitPoint.m_exitAge));
+    EXPECT_GT(numVertices(),numVerticesBefore);
+    const Instance *added = Q.m_instanceCache.getElement(exitPoint.m_exitId,exitPoint.m_exitAge,0);
+    ASSERT_LT(added->m_instanceStart,added->m_instanceEnd);
+    for(size_t i=added->m_instanceStart; i<added->m_instanceEnd; i++)
+    {
+      EXPECT_GE(Q.m_heroIndices[i],numVerticesBefore);
+      EXPECT_LT(Q.m_heroIndices[i],numVertices());
+    }
+  }
+}
+
+TEST(LSystem, optimiseInstanceVariety)
+{
+  LSystem L("F",{},1,1,90,1,0);
+  L.m_instanceCache.resizeCache(2,1);
+  L.m_forestMode = true;
+  BufferSink sink(L.m_heroVertices, L.m_heroIndices, L.m_heroWidths);
+  //the trunk leads to (1,1), which has four instances, the last one the same shape as the first
+  L.interpretTreeString("{(0,0)F[<(1,1)F>]}{(1,1)FF}{(1,1)F[&F]F}{(1,1)F}", sink);
+  ASSERT_EQ(L.m_instanceCache.numInstancesAt(1,1),4);
+
+  std::vector<float> usage = L.estimateInstanceUsage();
+  ASSERT_EQ(usage.size(),5);
+  EXPECT_FLOAT_EQ(usage[0],1.0f);
+  for(size_t i=1; i<5; i++)
+  {
+    EXPECT_FLOAT_EQ(usage[i],0.25f);
+  }
+
+  auto totalWeight = [](LSystem &_L)
+  {
+    size_t weight = 0;
+    for(size_t i=0; i<_L.m_instanceCache.numInstancesAt(1,1); i++)
+    {
+      weight += _L.m_instanceCache.getElement(1,1,i)->m_weight;
+    }
+    return weight;
+  };
+
+  //a draw call budget keeps the most different instance as well as one per slot
+  LSystem variants = L;
+  variants.optimiseInstanceVariety(0,3);
+  EXPECT_EQ(variants.m_instanceCache.numElements(),3);
+  ASSERT_EQ(variants.m_instanceCache.numInstancesAt(1,1),2);
+  EXPECT_EQ(variants.m_instanceCache.getElement(1,1,1)->m_instanceEnd-
+            variants.m_instanceCache.getElement(1,1,1)->m_instanceStart,6);
+  EXPECT_EQ(totalWeight(variants),4);
+
+  //an index budget only keeps what fits: 4 for the trunk, 2 for the first instance, then only FF fits
+  LSystem indices = L;
+  indices.optimiseInstanceVariety(10,0);
+  ASSERT_EQ(indices.m_instanceCache.numInstancesAt(1,1),2);
+  EXPECT_EQ(indices.m_instanceCache.getElement(1,1,1)->m_instanceEnd-
+            indices.m_instanceCache.getElement(1,1,1)->m_instanceStart,4);
+  EXPECT_EQ(totalWeight(indices),4);
+
+  //the duplicate is never worth keeping
+  LSystem unlimited = L;
+  unlimited.optimiseInstanceVariety(1000,1000);
+  EXPECT_EQ(unlimited.m_instanceCache.numInstancesAt(1,1),3);
+}
+
+TEST(LSystem, compactHeroGeometry)
+{
+  LSystem L("F",{},1,1,90,1,0);
+  L.m_instanceCache.resizeCache(3,1);
+  L.m_forestMode = true;
+  BufferSink sink(L.m_heroVertices, L.m_heroIndices, L.m_heroWidths);
+  L.interpretTreeString("FF{(1,0)F[&F]}F{(2,0)F}F", sink);
+
+  //remember which segments each instance draws
+  auto segments = [&](Instance * _instance)
+  {
+    std::vector<ngl::Vec3> result = {};
+    for(size_t i=_instance->m_instanceStart; i<_instance->m_instanceEnd; i++)
+    {
+      result.push_back(L.m_heroVertices[L.m_heroIndices[i]]);
+    }
+    return result;
+  };
+  Instance * first = L.m_instanceCache.getElement(1,0,0);
+  Instance * second = L.m_instanceCache.getElement(2,0,0);
+  std::vector<ngl::Vec3> firstSegments = segments(first);
+  std::vector<ngl::Vec3> secondSegments = segments(second);
+
+  L.compactHeroGeometry();
+
+  //the trunk segments outside the instances are gone
+  EXPECT_EQ(L.m_heroIndices.size(),6);
+  EXPECT_EQ(L.m_heroVertices.size(),5);
+  EXPECT_EQ(L.m_heroWidths.size(),5);
+  EXPECT_EQ(segments(first),firstSegments);
+  EXPECT_EQ(segments(second),secondSegments);
+}
+
+TEST(Forest, hybridMode)
+{
+  LSystem L("A",{"A=F[&FA]/(90)[&FA]"},1,1,30,1,3);
+  L.m_useSeed = true;
+  L.m_seed = 1;
+  L.createGeometry();
+  Forest forest({L},20,20,10,2);
+  forest.m_useSeed = true;
+  forest.m_hybridMode = true;
+  forest.m_numUniqueTrees = 3;
+  forest.m_focusPoint = ngl::Vec3(5,0,5);
+  forest.createForest();
+
+  //the nearest trees get their own geometry and stop using instances
+  ASSERT_EQ(forest.m_uniqueTrees.size(),3);
+  size_t numUnique = 0;
+  for(auto &tree : forest.m_treeData)
+  {
+    numUnique += tree.m_isUnique ? 1 : 0;
+  }
+  EXPECT_EQ(numUnique,3);
+  float furthestUnique = 0;
+  float nearestInstanced = 1e10f;
+  for(size_t i=0; i<forest.m_treeData.size(); i++)
+  {
+    const ngl::Mat4 &transform = forest.m_treeData[i].m_transform;
+    float distance = (ngl::Vec3(transform.m_30,transform.m_31,transform.m_32)-forest.m_focusPoint).length();
+    if(forest.m_treeData[i].m_isUnique)
+    {
+      furthestUnique = std::max(furthestUnique,distance);
+    }
+    else
+    {
+      nearestInstanced = std::min(nearestInstanced,distance);
+    }
+  }
+  EXPECT_LE(furthestUnique,nearestInstanced);
+  for(auto &uniqueTree : forest.m_uniqueTrees)
+  {
+    EXPECT_TRUE(forest.m_treeData[uniqueTree.m_treeIndex].m_isUnique);
+    EXPECT_GT(uniqueTree.m_indices.size(),0);
+    //unique trees are generated from the rules without any instancing commands, so match the tree on its own
+    EXPECT_EQ(uniqueTree.m_vertices.size(),L.m_vertices.size());
+  }
+
+  //with no time left, every tree falls back to instancing
+  forest.m_uniqueTreeBudget = -1;
+  forest.createForest();
+  EXPECT_TRUE(forest.m_uniqueTrees.empty());
+}
+
+TEST(Forest, optimiseInstanceVariety)
+{
+  LSystem L("A",{"A=F[&FA]/(90)[&FA]"},1,1,30,1,3);
+  L.m_useSeed = true;
+  L.m_seed = 1;
+  L.m_deduplicateInstances = false;
+  Forest forest({L},20,20,20,10);
+  forest.m_useSeed = true;
+  const CacheStructure<Instance> &cache = forest.m_treeTypes[0].m_instanceCache;
+  size_t numFilledSlots = cache.numSlots();
+  ASSERT_GT(cache.numElements(),numFilledSlots+1);
+
+  forest.optimiseInstanceVariety(0,numFilledSlots+1);
+  EXPECT_EQ(cache.numElements(),numFilledSlots+1);
+  EXPECT_EQ(forest.m_outputCache[0].m_offsets,cache.m_offsets);
+  EXPECT_GE(forest.m_output.size(),20);
+  for(auto &output : forest.m_output)
+  {
+    EXPECT_LT(output.m_innerIndex,cache.numInstancesAt(output.m_id,output.m_age));
+  }
+}
+
+TEST(Forest, addMissingInstance)
+{
+  LSystem L("A",{"A=F[&FA]/(90)[&FA]"},1,1,30,1,3);
+  L.m_useSeed = true;
+  L.m_seed = 1;
+  L.m_fillMissingInstances = false;
+  //there are no hero trees, so the empty slots are filled as the trees need them
+  Forest forest({L},20,20,5,0);
+  forest.m_useSeed = true;
+  forest.createForest();
+  const CacheStructure<Instance> &cache = forest.m_treeTypes[0].m_instanceCache;
+  EXPECT_GT(cache.numInstancesAt(0,0),0);
+  EXPECT_GE(forest.m_output.size(),5);
+  ASSERT_EQ(forest.m_outputCache[0].m_offsets,cache.m_offsets);
+  size_t numTransforms = 0;
+  forest.m_outputCache[0].forEachElement([&](std::vector<ngl::Mat4> &_transforms, size_t, size_t, size_t)
+  {
+    numTransforms += _transforms.size();
+  });
+  EXPECT_EQ(numTransforms,forest.m_output.size());
+}
+
+TEST(Forest, tuneInstancing)
+{
+  LSystem L("A",{"A=F[&FA]/(90)[&FA]"},1,1,30,1,3);
+  L.m_useSeed = true;
+  L.m_seed = 1;
+  Forest::TuningTargets targets;
+  targets.m_instancingProbs = {0.3f,0.9f};
+  targets.m_maxInstancesPerLevel = {1,8};
+  targets.m_width = 20;
+  targets.m_length = 20;
+  targets.m_numTrees = 5;
+  targets.m_numHeroTrees = 5;
+  std::vector<Forest::TuningSample> samples;
+  Forest::TuningSample unlimited = Forest::tuneInstancing(L,targets,&samples);
+  ASSERT_EQ(samples.size(),4);
+  EXPECT_EQ(unlimited.m_overBudget,0.0f);
+  for(auto &sample : samples)
+  {
+    EXPECT_GT(sample.m_bytes,0);
+    EXPECT_GT(sample.m_drawCalls,0);
+    EXPECT_LE(sample.m_drawCalls,unlimited.m_drawCalls);
+  }
+  EXPECT_EQ(L.m_instancingProb,unlimited.m_instancingProb);
+  EXPECT_EQ(L.m_maxInstancePerLevel,unlimited.m_maxInstancePerLevel);
+
+  //a draw call limit only the fewest variants fit
+  size_t fewest = samples[0].m_drawCalls;
+  for(auto &sample : samples)
+  {
+    fewest = std::min(fewest,sample.m_drawCalls);
+  }
+  targets.m_maxDrawCalls = fewest;
+  Forest::TuningSample limited = Forest::tuneInstancing(L,targets);
+  EXPECT_EQ(limited.m_overBudget,0.0f);
+  EXPECT_LE(limited.m_drawCalls,fewest);
+  EXPECT_EQ(L.m_maxInstancePerLevel,limited.m_maxInstancePerLevel);
+}
+
+TEST(Forest, expansionPlans)
+{
+  LSystem L("A",{"A=F[&FA]/(90)[&FA]"},1,1,30,1,4);
+  L.m_useSeed = true;
+  L.m_seed = 1;
+  Forest forest({L},20,20,50,5);
+  forest.m_useSeed = true;
+  const CacheStructure<Instance> &cache = forest.m_treeTypes[0].m_instanceCache;
+
+  //a plan one level deep wouldn't pick anything ahead, so the tree is walked without building any
+  forest.m_expansionPlanDepth = 1;
+  forest.createForest();
+  ASSERT_EQ(forest.m_expansionPlans[0].m_offsets,cache.m_offsets);
+  const Forest::ExpansionPlanArena &arena = forest.m_expansionPlanArenas[0];
+  EXPECT_TRUE(arena.m_instances.empty());
+  forest.m_expansionPlans[0].forEachElement([&](std::vector<Forest::ExpansionPlan> &_plans, size_t, size_t, size_t)
+  {
+    EXPECT_TRUE(_plans.empty());
+  });
+  for(auto &output : forest.m_output)
+  {
+    EXPECT_LT(output.m_innerIndex,cache.numInstancesAt(output.m_id,output.m_age));
+  }
+  size_t walkedInstances = forest.m_output.size();
+
+  //deeper plans cover several levels, with several variants of each
+  forest.m_expansionPlanDepth = 3;
+  forest.createForest();
+  size_t numTransforms = 0;
+  forest.m_outputCache[0].forEachElement([&](std::vector<ngl::Mat4> &_transforms, size_t, size_t, size_t)
+  {
+    numTransforms += _transforms.size();
+  });
+  EXPECT_EQ(numTransforms,forest.m_output.size());
+  size_t deepest = 0;
+  forest.m_expansionPlans[0].forEachElement([&](std::vector<Forest::ExpansionPlan> &_plans, size_t, size_t, size_t)
+  {
+    EXPECT_TRUE(_plans.empty() || _plans.size() == forest.m_numExpansionPlanVariants);
+    for(auto &plan : _plans)
+    {
+      deepest = std::max(deepest,plan.m_numInstances);
+      for(size_t i=plan.m_firstInstance; plan.m_isBuilt && i<plan.m_firstInstance+plan.m_numInstances; i++)
+      {
+        const Forest::OutputData &planned = arena.m_instances[i];
+        EXPECT_LT(planned.m_innerIndex,cache.numInstancesAt(planned.m_id,planned.m_age));
+      }
+    }
+  });
+  EXPECT_GT(deepest,1);
+  for(auto &tree : forest.m_treeData)
+  {
+    EXPECT_FALSE(tree.m_bounds.isEmpty());
+  }
+  //the trees are built from about as many instances as walking them one at a time
+  EXPECT_NEAR(float(forest.m_output.size()),float(walkedInstances),0.2f*float(walkedInstances));
+
+  //and trees using the same trunk instance still grow different subtrees from it
+  std::map<size_t, std::set<std::vector<size_t>>> subtrees;
+  forest.m_output = {};
+  forest.resizeOutputCache();
+  for(auto &tree : forest.m_treeData)
+  {
+    size_t numOutput = forest.m_output.size();
+    forest.createTree(tree.m_type,tree.m_transform,0,0,tree.m_bounds);
+    std::vector<size_t> picks = {};
+    for(size_t o=numOutput; o<forest.m_output.size(); o++)
+    {
+      picks.push_back(forest.m_output[o].m_innerIndex);
+    }
+    subtrees[forest.m_output[numOutput].m_innerIndex].insert(picks);
+  }
+  for(auto &trunk : subtrees)
+  {
+    EXPECT_GT(trunk.second.size(),1);
+  }
+}